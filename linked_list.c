@@ -11,16 +11,22 @@
 pthread_rwlock_t list_rwlock = PTHREAD_RWLOCK_INITIALIZER; // Read-Write lock for read-heavy functions.
 pthread_mutex_t list_mutex = PTHREAD_MUTEX_INITIALIZER;    // Mutex lock for write-heavy functions.
 
+// Nodes are fixed-size, so they come from a slab instead of mem_alloc. The list has a pool of its
+// own, so it neither replaces nor contends with the caller's default pool.
+static mem_pool_t* node_pool = NULL;
+static mem_slab_t* node_slab = NULL;
+
 
 void list_init(Node** head, size_t size) {
     *head = NULL;
-    mem_init(size);
+    node_pool = mem_pool_create(size, NULL);
+    node_slab = mem_pool_slab_create(node_pool, sizeof(Node), size / sizeof(Node));
 }
 
 void list_insert(Node** head, uint16_t data) {
     pthread_mutex_lock(&list_mutex); 
 
-    Node* new_node = (Node*)mem_alloc(sizeof(Node));
+    Node* new_node = (Node*)mem_slab_alloc(node_slab);
     if (!new_node) {
         printf("Memory allocation failed\n");
         pthread_mutex_unlock(&list_mutex); 
@@ -51,7 +57,7 @@ void list_insert_after(Node* prev_node, uint16_t data) {
 
     pthread_mutex_lock(&list_mutex);
 
-    Node* new_node = (Node*)mem_alloc(sizeof(Node));
+    Node* new_node = (Node*)mem_slab_alloc(node_slab);
     if (!new_node) {
         printf("Memory allocation failed\n");
         pthread_mutex_unlock(&list_mutex); 
@@ -73,7 +79,7 @@ void list_insert_before(Node** head, Node* next_node, uint16_t data) {
 
     pthread_mutex_lock(&list_mutex); 
 
-    Node* new_node = (Node*)mem_alloc(sizeof(Node));
+    Node* new_node = (Node*)mem_slab_alloc(node_slab);
     if (!new_node) {
         printf("Memory allocation failed\n");
         pthread_mutex_unlock(&list_mutex);
@@ -92,7 +98,7 @@ void list_insert_before(Node** head, Node* next_node, uint16_t data) {
 
         if (current == NULL) {
             printf("The specified next node is not in the list\n");
-            mem_free(new_node);
+            mem_slab_free(node_slab, new_node);
             pthread_mutex_unlock(&list_mutex);
             return;
         }
@@ -133,7 +139,7 @@ void list_delete(Node** head, uint16_t data) {
         previous->next = current->next;
     }
 
-    mem_free(current);
+    mem_slab_free(node_slab, current);
 
     pthread_mutex_unlock(&list_mutex); 
 }
@@ -208,11 +214,14 @@ void list_cleanup(Node** head) {
     Node* current = *head;
     while (current != NULL) {
         Node* next_node = current->next;
-        mem_free(current);
+        mem_slab_free(node_slab, current);
         current = next_node;
     }
     *head = NULL;
-    mem_deinit();
+    mem_slab_destroy(node_slab);
+    node_slab = NULL;
+    mem_pool_destroy(node_pool);
+    node_pool = NULL;
 
     pthread_mutex_unlock(&list_mutex);
 }
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory_manager_internal.h"
+
+// Small blocks come from runs: an ordinary block of BITMAP_RUN_SIZE bytes, aligned to its size and cut
+// into granules of one power-of-two size. A run keeps one occupancy bit per granule instead of a
+// Memory_Block per block, plus a summary word with a bit for every bitmap word that still has a free
+// granule. Finding a free granule is then two count-trailing-zeros, whatever the run's occupancy.
+
+int bitmap_class(size_t granule) {
+    return __builtin_ctzll((unsigned long long)granule) - BITMAP_MIN_SHIFT;
+}
+
+static void list_insert(Mem_Arena* arena, Bitmap_Run* run) {
+    Bitmap_Run** head = &arena->runs[bitmap_class(run->granule)];
+    run->prev = NULL;
+    run->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = run;
+    }
+    *head = run;
+}
+
+static void list_remove(Mem_Arena* arena, Bitmap_Run* run) {
+    if (run->prev != NULL) {
+        run->prev->next = run->next;
+    } else {
+        arena->runs[bitmap_class(run->granule)] = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+    run->prev = NULL;
+    run->next = NULL;
+}
+
+// Turns an allocated block of BITMAP_RUN_SIZE bytes into an empty run of the given granule. NULL when
+// the run header cannot be allocated; the block is then left as it was.
+Bitmap_Run* bitmap_run_create(Mem_Arena* arena, Memory_Block* block, size_t granule) {
+    // A recycled header keeps its arena field untouched; lock_run may be reading it.
+    Bitmap_Run* run = arena->spare_runs;
+    if (run != NULL) {
+        arena->spare_runs = run->next;
+    } else if ((run = malloc(sizeof(Bitmap_Run))) != NULL) {
+        run->arena = arena;
+    } else {
+        return NULL;
+    }
+
+    memset(run->words, 0, sizeof(run->words));
+    run->used = 0;
+    run->block = block;
+    run->base = block->pnt;
+    run->granule = granule;
+    run->shift = __builtin_ctzll((unsigned long long)granule);
+    run->count = (int)(BITMAP_RUN_SIZE >> run->shift);
+
+    // Bits past the last granule are marked used so they are never handed out.
+    int words = (run->count + 63) / 64;
+    if (run->count % 64 != 0) {
+        run->words[words - 1] = ~0ULL << (run->count % 64);
+    }
+    run->nonfull = words < 64 ? (1ULL << words) - 1 : ~0ULL;
+
+    list_insert(arena, run);
+    __atomic_store_n(&block->run, run, __ATOMIC_RELEASE);
+    return run;
+}
+
+// Detaches an empty run from its block; the caller frees the block. The header is kept for the next
+// run, so a lookup that raced with this still finds valid memory (see lock_run).
+void bitmap_run_destroy(Mem_Arena* arena, Bitmap_Run* run) {
+    list_remove(arena, run);
+    __atomic_store_n(&run->block->run, NULL, __ATOMIC_RELEASE);
+    run->block = NULL;
+    run->next = arena->spare_runs;
+    arena->spare_runs = run;
+}
+
+// Frees every run header of an arena that is being torn down.
+void bitmap_release_runs(Mem_Arena* arena) {
+    for (Memory_Block* block = arena->blocks; block != NULL; block = block->next) {
+        free(block->run);
+        block->run = NULL;
+    }
+    while (arena->spare_runs != NULL) {
+        Bitmap_Run* next = arena->spare_runs->next;
+        free(arena->spare_runs);
+        arena->spare_runs = next;
+    }
+    memset(arena->runs, 0, sizeof(arena->runs));
+}
+
+// Hands out the lowest free granule. The run must have one, i.e. be on its arena's list.
+void* bitmap_take(Mem_Arena* arena, Bitmap_Run* run) {
+    int word = __builtin_ctzll(run->nonfull);
+    int bit = __builtin_ctzll(~run->words[word]);
+    run->words[word] |= 1ULL << bit;
+    if (run->words[word] == ~0ULL) {
+        run->nonfull &= ~(1ULL << word);
+        if (run->nonfull == 0) {
+            list_remove(arena, run);
+        }
+    }
+    run->used++;
+    return run->base + ((size_t)(word * 64 + bit) << run->shift);
+}
+
+// Granule index of ptr, or -1 when ptr is not the start of a granule of the run.
+static int granule_index(Bitmap_Run* run, void* ptr) {
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)run->base;
+    if (offset >= BITMAP_RUN_SIZE || (offset & (run->granule - 1)) != 0) {
+        return -1;
+    }
+    return (int)(offset >> run->shift);
+}
+
+bool bitmap_is_live(Bitmap_Run* run, void* ptr) {
+    int index = granule_index(run, ptr);
+    return index >= 0 && index < run->count && (run->words[index / 64] & (1ULL << (index % 64))) != 0;
+}
+
+// Returns the granule at ptr to the run. False for pointers that are not a live granule (double frees).
+bool bitmap_release(Mem_Arena* arena, Bitmap_Run* run, void* ptr) {
+    if (!bitmap_is_live(run, ptr)) {
+        return false;
+    }
+    int index = granule_index(run, ptr);
+    if (run->nonfull == 0) {
+        list_insert(arena, run);
+    }
+    run->words[index / 64] &= ~(1ULL << (index % 64));
+    run->nonfull |= 1ULL << (index / 64);
+    run->used--;
+    return true;
+}
@@ -0,0 +1,222 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory_manager_internal.h"
+
+// Buddy backend: every block is 2^k bytes at an arena offset that is a multiple of 2^k, so a
+// block's buddy sits at offset ^ 2^k. The free lists of the segregated backend are reused with
+// class k holding exactly the free blocks of order k.
+#define BUDDY_MIN_ORDER 3 // Smallest block is 8 bytes
+
+static int block_order(size_t size) {
+    if (size <= ((size_t)1 << BUDDY_MIN_ORDER)) {
+        return BUDDY_MIN_ORDER;
+    }
+    return 64 - __builtin_clzll((unsigned long long)(size - 1));
+}
+
+// Adds a free block of the given order after prev in the address-ordered chain.
+static Memory_Block* add_free_block(Mem_Arena* arena, Memory_Block* prev, char* pnt, int order) {
+    Memory_Block* block = new_descriptor(arena);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    block->pnt = pnt;
+    block->size = (size_t)1 << order;
+    block->free = true;
+    block->prev = prev;
+    if (prev != NULL) {
+        block->next = prev->next;
+        prev->next = block;
+    } else {
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block;
+    }
+    free_list_insert(arena, block);
+    return block;
+}
+
+// Covers the arena with maximal power-of-two blocks, largest first. Each block's offset is a sum of
+// larger powers of two and therefore aligned to its size. The tail below the minimum order is unused.
+bool buddy_init_arena(Mem_Arena* arena) {
+    size_t offset = 0;
+    Memory_Block* last = NULL;
+
+    while (arena->size - offset >= ((size_t)1 << BUDDY_MIN_ORDER)) {
+        int order = size_class(arena->size - offset);
+        last = add_free_block(arena, last, arena->base + offset, order);
+        if (last == NULL) {
+            return false;
+        }
+        offset += (size_t)1 << order;
+    }
+    return true;
+}
+
+// Halves a free block that is off the free lists down to order, keeping the half that holds target
+// each time and putting the other half on the free lists. The result is allocated.
+static Memory_Block* split_block_to(Mem_Arena* arena, Memory_Block* block, int order, char* target) {
+    int current_order = size_class(block->size);
+    while (current_order > order) {
+        current_order--;
+        Memory_Block* upper = add_free_block(arena, block, (char*)block->pnt + ((size_t)1 << current_order), current_order);
+        if (upper == NULL) {
+            // Out of descriptors: give back the part that could not be split.
+            free_list_insert(arena, block);
+            return NULL;
+        }
+        block->size = (size_t)1 << current_order;
+        arena->splits++;
+        if (target >= (char*)upper->pnt) {
+            free_list_remove(arena, upper);
+            free_list_insert(arena, block);
+            block = upper;
+        }
+    }
+
+    block->free = false;
+    index_insert(block);
+    arena->allocated += block->size;
+    return block;
+}
+
+// Takes the smallest free block of at least the request's order and halves it down to that order.
+Memory_Block* buddy_allocate_block(Mem_Arena* arena, size_t size) {
+    int order = block_order(size);
+    if (order >= NUM_SIZE_CLASSES) {
+        return NULL;
+    }
+
+    uint64_t candidates = arena->free_class_bitmap & (~0ULL << order);
+    if (candidates == 0) {
+        return NULL;
+    }
+    Memory_Block* block = arena->free_lists[__builtin_ctzll(candidates)];
+    free_list_remove(arena, block);
+    return split_block_to(arena, block, order, block->pnt);
+}
+
+// For an alignment beyond the arena start's own, no block of that size is aligned, but a smaller block
+// inside one can be: the aligned addresses sit at a fixed offset from every multiple of the alignment.
+// Looks through the free blocks from the request's order up for one that holds an aligned block of
+// the request's order and splits down to it. The request may be at most as large as the arena start
+// is aligned, since larger blocks all share the start's misalignment.
+Memory_Block* buddy_allocate_aligned(Mem_Arena* arena, size_t size, size_t alignment) {
+    int order = block_order(size);
+    uintptr_t start = (uintptr_t)arena->base;
+    if (order >= NUM_SIZE_CLASSES || ((size_t)1 << order) > (start & -start)) {
+        return NULL;
+    }
+
+    uint64_t candidates = arena->free_class_bitmap & (~0ULL << order);
+    while (candidates != 0) {
+        int current_order = __builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+        for (Memory_Block* block = arena->free_lists[current_order]; block != NULL; block = block->free_next) {
+            char* target = (char*)block->pnt + (-(uintptr_t)block->pnt & (alignment - 1));
+            if (target + ((size_t)1 << order) <= (char*)block->pnt + block->size) {
+                free_list_remove(arena, block);
+                return split_block_to(arena, block, order, target);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Returns a block and merges it with its buddy for as long as the buddy is a whole free block.
+void buddy_free_block(Memory_Block* block) {
+    Mem_Arena* arena = block->arena;
+
+    index_remove(block);
+    arena->allocated -= block->size;
+    block->free = true;
+
+    // Buddies below the release threshold have kept their pages; they are always absorbed first.
+    char* release_from = block->pnt;
+    char* release_to = (char*)block->pnt + block->size;
+
+    for (;;) {
+        size_t offset = (size_t)((char*)block->pnt - arena->base);
+        size_t buddy_offset = offset ^ block->size;
+
+        // A free buddy of the same order is always the direct neighbour in the chain.
+        Memory_Block* buddy = buddy_offset > offset ? block->next : block->prev;
+        if (buddy == NULL || !buddy->free || buddy->size != block->size ||
+            (char*)buddy->pnt != arena->base + buddy_offset) {
+            break;
+        }
+
+        if (buddy->size < arena->release_threshold) {
+            release_from = buddy_offset > offset ? release_from : buddy->pnt;
+            release_to = buddy_offset > offset ? (char*)buddy->pnt + buddy->size : release_to;
+        }
+        free_list_remove(arena, buddy);
+        Memory_Block* lower = buddy_offset > offset ? block : buddy;
+        Memory_Block* upper = buddy_offset > offset ? buddy : block;
+        lower->size *= 2;
+        lower->next = upper->next;
+        if (upper->next != NULL) {
+            upper->next->prev = lower;
+        }
+        release_descriptor(arena, upper);
+        arena->merges++;
+        block = lower;
+    }
+
+    free_list_insert(arena, block);
+    os_release_free_pages(arena, block, release_from, release_to);
+}
+
+// Shrinks by splitting off upper halves, or grows by absorbing free upper buddies, without moving the block.
+bool buddy_resize_block(Memory_Block* block, size_t new_size) {
+    Mem_Arena* arena = block->arena;
+    int order = block_order(new_size);
+    int current_order = size_class(block->size);
+
+    if (order <= current_order) {
+        while (current_order > order) {
+            current_order--;
+            Memory_Block* half = add_free_block(arena, block, (char*)block->pnt + ((size_t)1 << current_order), current_order);
+            if (half == NULL) {
+                break; // Out of descriptors: keep the rest of the slack.
+            }
+            block->size = (size_t)1 << current_order;
+            arena->allocated -= block->size;
+            arena->splits++;
+            os_release_free_pages(arena, half, half->pnt, (char*)half->pnt + half->size);
+        }
+        return true;
+    }
+
+    // Growing needs every upper buddy up to the target order to be a whole free block.
+    size_t offset = (size_t)((char*)block->pnt - arena->base);
+    if (order >= NUM_SIZE_CLASSES || offset % ((size_t)1 << order) != 0) {
+        return false;
+    }
+    Memory_Block* buddy = block->next;
+    for (int k = current_order; k < order; k++) {
+        if (buddy == NULL || !buddy->free || buddy->size != ((size_t)1 << k) ||
+            (char*)buddy->pnt != (char*)block->pnt + ((size_t)1 << k)) {
+            return false;
+        }
+        buddy = buddy->next;
+    }
+
+    while (current_order < order) {
+        buddy = block->next;
+        free_list_remove(arena, buddy);
+        block->next = buddy->next;
+        if (buddy->next != NULL) {
+            buddy->next->prev = block;
+        }
+        release_descriptor(arena, buddy);
+        arena->merges++;
+        arena->allocated += block->size;
+        block->size *= 2;
+        current_order++;
+    }
+    return true;
+}
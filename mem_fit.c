@@ -0,0 +1,353 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "memory_manager_internal.h"
+
+// Placement policies for the segregated backend. Best-fit and address-ordered first-fit keep the free
+// blocks in a treap instead of the size-class lists: free_prev and free_next serve as the left and
+// right child, and the heap priority is a hash of the block address, so nothing extra is stored.
+// Each node also records the largest free size in its subtree, which lets address-ordered first-fit
+// skip whole subtrees that cannot hold the request.
+
+static uint64_t priority(Memory_Block* block) {
+    return (uint64_t)(uintptr_t)block->pnt * 0x9E3779B97F4A7C15ULL;
+}
+
+// Best-fit orders by (size, address); address-ordered first-fit by address alone.
+static bool tree_less(Mem_Arena* arena, Memory_Block* a, Memory_Block* b) {
+    if (arena->fit == MEM_FIT_BEST && a->size != b->size) {
+        return a->size < b->size;
+    }
+    return (uintptr_t)a->pnt < (uintptr_t)b->pnt;
+}
+
+static void update(Memory_Block* node) {
+    size_t largest = node->size;
+    if (node->free_prev != NULL && node->free_prev->subtree_max > largest) {
+        largest = node->free_prev->subtree_max;
+    }
+    if (node->free_next != NULL && node->free_next->subtree_max > largest) {
+        largest = node->free_next->subtree_max;
+    }
+    node->subtree_max = largest;
+}
+
+static Memory_Block* tree_insert(Mem_Arena* arena, Memory_Block* root, Memory_Block* node) {
+    if (root == NULL) {
+        node->free_prev = NULL;
+        node->free_next = NULL;
+        update(node);
+        return node;
+    }
+
+    if (tree_less(arena, node, root)) {
+        root->free_prev = tree_insert(arena, root->free_prev, node);
+        if (priority(root->free_prev) > priority(root)) {
+            Memory_Block* left = root->free_prev;
+            root->free_prev = left->free_next;
+            left->free_next = root;
+            update(root);
+            root = left;
+        }
+    } else {
+        root->free_next = tree_insert(arena, root->free_next, node);
+        if (priority(root->free_next) > priority(root)) {
+            Memory_Block* right = root->free_next;
+            root->free_next = right->free_prev;
+            right->free_prev = root;
+            update(root);
+            root = right;
+        }
+    }
+    update(root);
+    return root;
+}
+
+static Memory_Block* tree_merge(Memory_Block* left, Memory_Block* right) {
+    if (left == NULL) {
+        return right;
+    }
+    if (right == NULL) {
+        return left;
+    }
+    if (priority(left) > priority(right)) {
+        left->free_next = tree_merge(left->free_next, right);
+        update(left);
+        return left;
+    }
+    right->free_prev = tree_merge(left, right->free_prev);
+    update(right);
+    return right;
+}
+
+static Memory_Block* tree_remove(Mem_Arena* arena, Memory_Block* root, Memory_Block* node) {
+    if (root == NULL) {
+        return NULL;
+    }
+    if (root == node) {
+        Memory_Block* merged = tree_merge(node->free_prev, node->free_next);
+        node->free_prev = NULL;
+        node->free_next = NULL;
+        return merged;
+    }
+
+    if (tree_less(arena, node, root)) {
+        root->free_prev = tree_remove(arena, root->free_prev, node);
+    } else {
+        root->free_next = tree_remove(arena, root->free_next, node);
+    }
+    update(root);
+    return root;
+}
+
+void fit_tree_insert(Mem_Arena* arena, Memory_Block* block) {
+    arena->free_tree = tree_insert(arena, arena->free_tree, block);
+}
+
+void fit_tree_remove(Mem_Arena* arena, Memory_Block* block) {
+    arena->free_tree = tree_remove(arena, arena->free_tree, block);
+}
+
+Memory_Block* fit_tree_find(Mem_Arena* arena, size_t size) {
+    Memory_Block* current = arena->free_tree;
+
+    if (arena->fit == MEM_FIT_BEST) {
+        // Smallest (size, address) that is not below the request.
+        Memory_Block* best = NULL;
+        while (current != NULL) {
+            if (current->size >= size) {
+                best = current;
+                current = current->free_prev;
+            } else {
+                current = current->free_next;
+            }
+        }
+        return best;
+    }
+
+    // Lowest address that fits: go left whenever the left subtree can hold the request.
+    if (current == NULL || current->subtree_max < size) {
+        return NULL;
+    }
+    for (;;) {
+        if (current->free_prev != NULL && current->free_prev->subtree_max >= size) {
+            current = current->free_prev;
+        } else if (current->size >= size) {
+            return current;
+        } else {
+            current = current->free_next;
+        }
+    }
+}
+
+// Next-fit keeps its free blocks in a Free_Table. Finding a fit is a linear scan in address order,
+// which over a linked chain costs a cache miss per block; over the packed size array it is a few
+// blocks per compare instruction and a sequential stream the prefetcher follows.
+
+// Adds room for extra more blocks. False when the memory cannot be had; the table is then unchanged.
+bool free_table_grow(Free_Table* table, size_t extra) {
+    size_t capacity = table->capacity + extra;
+    uintptr_t* addrs = realloc(table->addrs, capacity * sizeof(uintptr_t));
+    if (addrs == NULL) {
+        return false;
+    }
+    table->addrs = addrs;
+    uint64_t* sizes = realloc(table->sizes, capacity * sizeof(uint64_t));
+    if (sizes == NULL) {
+        return false;
+    }
+    table->sizes = sizes;
+    Memory_Block** blocks = realloc(table->blocks, capacity * sizeof(Memory_Block*));
+    if (blocks == NULL) {
+        return false;
+    }
+    table->blocks = blocks;
+    table->capacity = capacity;
+    return true;
+}
+
+void free_table_release(Free_Table* table) {
+    free(table->addrs);
+    free(table->sizes);
+    free(table->blocks);
+    memset(table, 0, sizeof(*table));
+}
+
+// Index of the first entry starting at or after addr. A split, a merge and the rover all look up
+// addresses next to the previous lookup, so the neighbourhood of the hint is tried first.
+static size_t lower_bound(Free_Table* table, uintptr_t addr) {
+    size_t hint = table->hint;
+    for (size_t i = hint > 0 ? hint - 1 : 0; i <= hint + 1 && i <= table->count; i++) {
+        if ((i == table->count || table->addrs[i] >= addr) && (i == 0 || table->addrs[i - 1] < addr)) {
+            table->hint = i;
+            return i;
+        }
+    }
+
+    size_t low = 0;
+    size_t high = table->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (table->addrs[mid] < addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    table->hint = low;
+    return low;
+}
+
+// Squeezes the holes out of the table.
+static void compact(Free_Table* table) {
+    size_t kept = 0;
+    for (size_t i = 0; i < table->count; i++) {
+        if (table->sizes[i] != 0) {
+            table->addrs[kept] = table->addrs[i];
+            table->sizes[kept] = table->sizes[i];
+            table->blocks[kept] = table->blocks[i];
+            kept++;
+        }
+    }
+    table->count = kept;
+    table->holes = 0;
+}
+
+static void fill(Free_Table* table, size_t i, Memory_Block* block) {
+    table->addrs[i] = (uintptr_t)block->pnt;
+    table->sizes[i] = block->size;
+    table->blocks[i] = block;
+}
+
+// Splits and merges remove a block and insert one at nearly the same address, so the insert
+// usually lands in the hole the removal left and nothing has to move.
+void free_table_insert(Free_Table* table, Memory_Block* block) {
+    uintptr_t addr = (uintptr_t)block->pnt;
+    size_t i = lower_bound(table, addr);
+    if (i < table->count && table->sizes[i] == 0) {
+        fill(table, i, block);
+        table->holes--;
+        return;
+    }
+    if (i > 0 && table->sizes[i - 1] == 0) {
+        fill(table, i - 1, block);
+        table->holes--;
+        return;
+    }
+
+    // Holes take slots too; they go once they fill the table or outnumber the blocks.
+    if (table->count == table->capacity || table->holes > table->count / 2) {
+        compact(table);
+        i = lower_bound(table, addr);
+    }
+    size_t tail = table->count - i;
+    memmove(&table->addrs[i + 1], &table->addrs[i], tail * sizeof(uintptr_t));
+    memmove(&table->sizes[i + 1], &table->sizes[i], tail * sizeof(uint64_t));
+    memmove(&table->blocks[i + 1], &table->blocks[i], tail * sizeof(Memory_Block*));
+    fill(table, i, block);
+    table->count++;
+}
+
+void free_table_remove(Free_Table* table, Memory_Block* block) {
+    size_t i = lower_bound(table, (uintptr_t)block->pnt);
+    if (i == table->count || table->blocks[i] != block || table->sizes[i] == 0) {
+        return;
+    }
+    if (i == table->count - 1) {
+        table->count--;
+        return;
+    }
+    table->sizes[i] = 0;
+    table->holes++;
+}
+
+// The scans return the index of the first size of at least size (so never a hole), or count. The
+// vector versions compare signed 64-bit lanes against size - 1; block sizes stay far below 2^63.
+
+static size_t scan_scalar(const uint64_t* sizes, size_t count, uint64_t size) {
+    for (size_t i = 0; i < count; i++) {
+        if (sizes[i] >= size) {
+            return i;
+        }
+    }
+    return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static size_t scan_avx2(const uint64_t* sizes, size_t count, uint64_t size) {
+    __m256i limit = _mm256_set1_epi64x((long long)(size - 1));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i low = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i*)&sizes[i]), limit);
+        __m256i high = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i*)&sizes[i + 4]), limit);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(low)) | _mm256_movemask_pd(_mm256_castsi256_pd(high)) << 4;
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scan_scalar(&sizes[i], count - i, size);
+}
+
+__attribute__((target("sse4.2"))) static size_t scan_sse42(const uint64_t* sizes, size_t count, uint64_t size) {
+    __m128i limit = _mm_set1_epi64x((long long)(size - 1));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i low = _mm_cmpgt_epi64(_mm_loadu_si128((const __m128i*)&sizes[i]), limit);
+        __m128i high = _mm_cmpgt_epi64(_mm_loadu_si128((const __m128i*)&sizes[i + 2]), limit);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(low)) | _mm_movemask_pd(_mm_castsi128_pd(high)) << 2;
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scan_scalar(&sizes[i], count - i, size);
+}
+#endif
+
+typedef size_t (*Scan_Fn)(const uint64_t* sizes, size_t count, uint64_t size);
+
+static Scan_Fn scan_fn;
+
+// The widest scan the CPU supports, picked on first use.
+static Scan_Fn select_scan(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return scan_sse42;
+    }
+#endif
+    return scan_scalar;
+}
+
+size_t free_table_scan(const uint64_t* sizes, size_t count, size_t size) {
+    if (size > INT64_MAX) {
+        return count;
+    }
+    Scan_Fn fn = __atomic_load_n(&scan_fn, __ATOMIC_RELAXED);
+    if (fn == NULL) {
+        fn = select_scan();
+        __atomic_store_n(&scan_fn, fn, __ATOMIC_RELAXED);
+    }
+    return fn(sizes, count, size > 0 ? size : 1);
+}
+
+// Next-fit resumes the address-ordered scan where the previous allocation ended, wrapping once.
+Memory_Block* next_fit_find(Mem_Arena* arena, size_t size) {
+    Free_Table* table = &arena->free_table;
+    size_t start = arena->rover != NULL ? lower_bound(table, (uintptr_t)arena->rover->pnt) : 0;
+
+    size_t i = start + free_table_scan(&table->sizes[start], table->count - start, size);
+    if (i == table->count) {
+        i = free_table_scan(table->sizes, start, size);
+        if (i == start) {
+            return NULL;
+        }
+    }
+    return table->blocks[i];
+}
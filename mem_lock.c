@@ -0,0 +1,208 @@
+#define _GNU_SOURCE // For syscall
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "memory_manager_internal.h"
+
+// Arena locks. The critical sections are a few hundred nanoseconds, so a waiter that goes straight to
+// sleep in the kernel (as a contended pthread mutex does after a very short spin) pays far more for the
+// round trip than the wait itself. Both alternatives here spin first and only park on a futex when the
+// holder is slow, e.g. because it was preempted.
+
+// Spin rounds double from 1 to SPIN_LIMIT pause instructions before a waiter parks.
+#define SPIN_LIMIT 1024
+
+static int spin_limit_cache = -1;
+
+// Queue nodes an MCS waiter spins on; one per arena lock a thread can hold at the same time.
+#define MCS_NODES 32
+
+static __thread Mcs_Node mcs_nodes[MCS_NODES];
+static __thread uint32_t mcs_nodes_used;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield" ::: "memory");
+#else
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+// On a single CPU the holder cannot run while a waiter spins, so waiters park right away.
+static int spin_limit(void) {
+    int limit = __atomic_load_n(&spin_limit_cache, __ATOMIC_RELAXED);
+    if (limit < 0) {
+        limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+        __atomic_store_n(&spin_limit_cache, limit, __ATOMIC_RELAXED);
+    }
+    return limit;
+}
+
+static void futex_wait(uint32_t* word, uint32_t expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t* word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// Adaptive lock: state is 0 when free, 1 when held, 2 when held and a waiter may be asleep.
+
+static bool adaptive_try(Mem_Lock* lock) {
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(&lock->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void adaptive_acquire(Mem_Lock* lock) {
+    if (adaptive_try(lock)) {
+        return;
+    }
+    // Spin with exponential backoff, then park.
+    int limit = spin_limit();
+    for (int spins = 1; spins <= limit; spins *= 2) {
+        for (int i = 0; i < spins; i++) {
+            cpu_relax();
+        }
+        if (__atomic_load_n(&lock->state, __ATOMIC_RELAXED) == 0 && adaptive_try(lock)) {
+            return;
+        }
+    }
+    // Taking the lock as 2 is conservative: the release after this holder may wake nobody.
+    while (__atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex_wait(&lock->state, 2);
+    }
+}
+
+static void adaptive_release(Mem_Lock* lock) {
+    if (__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE) == 2) {
+        futex_wake(&lock->state);
+    }
+}
+
+// MCS lock: waiters queue behind tail and each spins on its own node, so a release touches one cache
+// line of the next waiter and the lock is handed over in arrival order. A node's wait word is 1 while
+// its thread waits, 2 once it has parked, and 0 when the lock has been passed to it.
+
+static Mcs_Node* mcs_node(void) {
+    int slot = __builtin_ctz(~mcs_nodes_used);
+    mcs_nodes_used |= 1U << slot;
+    return &mcs_nodes[slot];
+}
+
+static void mcs_put_node(Mcs_Node* node) {
+    mcs_nodes_used &= ~(1U << (node - mcs_nodes));
+}
+
+static bool mcs_try(Mem_Lock* lock) {
+    Mcs_Node* node = mcs_node();
+    Mcs_Node* expected = NULL;
+    node->next = NULL;
+    if (__atomic_compare_exchange_n(&lock->tail, &expected, node, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        lock->holder = node;
+        return true;
+    }
+    mcs_put_node(node);
+    return false;
+}
+
+static void mcs_acquire(Mem_Lock* lock) {
+    Mcs_Node* node = mcs_node();
+    node->next = NULL;
+    node->wait = 1;
+    Mcs_Node* prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev != NULL) {
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        int limit = spin_limit();
+        for (int spins = 1; spins <= limit && __atomic_load_n(&node->wait, __ATOMIC_ACQUIRE) != 0; spins *= 2) {
+            for (int i = 0; i < spins; i++) {
+                cpu_relax();
+            }
+        }
+        uint32_t expected = 1;
+        if (__atomic_compare_exchange_n(&node->wait, &expected, 2, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            while (__atomic_load_n(&node->wait, __ATOMIC_ACQUIRE) != 0) {
+                futex_wait(&node->wait, 2);
+            }
+        }
+    }
+    lock->holder = node;
+}
+
+static void mcs_release(Mem_Lock* lock) {
+    Mcs_Node* node = lock->holder;
+    Mcs_Node* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+        Mcs_Node* expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            mcs_put_node(node);
+            return;
+        }
+        // A waiter swapped itself in but has not linked up yet.
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {
+            cpu_relax();
+        }
+    }
+    if (__atomic_exchange_n(&next->wait, 0, __ATOMIC_RELEASE) == 2) {
+        futex_wake(&next->wait);
+    }
+    mcs_put_node(node);
+}
+
+void lock_init(Mem_Lock* lock, mem_lock_t kind) {
+    lock->kind = kind == MEM_LOCK_ADAPTIVE || kind == MEM_LOCK_MCS ? kind : MEM_LOCK_MUTEX;
+    lock->state = 0;
+    lock->tail = NULL;
+    lock->holder = NULL;
+    if (lock->kind == MEM_LOCK_MUTEX) {
+        pthread_mutex_init(&lock->mutex, NULL);
+    }
+}
+
+void lock_destroy(Mem_Lock* lock) {
+    if (lock->kind == MEM_LOCK_MUTEX) {
+        pthread_mutex_destroy(&lock->mutex);
+    }
+}
+
+bool lock_try(Mem_Lock* lock) {
+    switch (lock->kind) {
+    case MEM_LOCK_ADAPTIVE:
+        return adaptive_try(lock);
+    case MEM_LOCK_MCS:
+        return mcs_try(lock);
+    default:
+        return pthread_mutex_trylock(&lock->mutex) == 0;
+    }
+}
+
+void lock_acquire(Mem_Lock* lock) {
+    switch (lock->kind) {
+    case MEM_LOCK_ADAPTIVE:
+        adaptive_acquire(lock);
+        break;
+    case MEM_LOCK_MCS:
+        mcs_acquire(lock);
+        break;
+    default:
+        pthread_mutex_lock(&lock->mutex);
+        break;
+    }
+}
+
+void lock_release(Mem_Lock* lock) {
+    switch (lock->kind) {
+    case MEM_LOCK_ADAPTIVE:
+        adaptive_release(lock);
+        break;
+    case MEM_LOCK_MCS:
+        mcs_release(lock);
+        break;
+    default:
+        pthread_mutex_unlock(&lock->mutex);
+        break;
+    }
+}
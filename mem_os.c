@@ -0,0 +1,221 @@
+#define _GNU_SOURCE // For MAP_HUGETLB, MADV_HUGEPAGE and getcpu
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "memory_manager_internal.h"
+
+// Requests for MEM_PAGES_HUGETLB are rounded up to this; it is the default huge page size on x86-64 and arm64.
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+// A lazily committed arena is made writable this much at a time as its high-water mark advances.
+#define COMMIT_GRANULE ((size_t)256 << 10)
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 // Linux 5.14; older C libraries lack the constant
+#endif
+
+static size_t page_size(void) {
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (size_t)size : 4096;
+}
+
+// Maps a fresh anonymous pool. *mapped_size receives the length to pass to os_unmap_pool.
+// With lazy_commit the range is only reserved (PROT_NONE) and os_commit makes it usable piece by piece.
+void* os_map_pool(size_t size, const mem_options_t* options, size_t* mapped_size) {
+    void* pool = MAP_FAILED;
+    size_t length = size > 0 ? size : 1;
+    int prot = options->lazy_commit ? PROT_NONE : PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (options->lazy_commit) {
+        flags |= MAP_NORESERVE;
+    } else if (options->prefault == MEM_PREFAULT_POPULATE) {
+        flags |= MAP_POPULATE;
+    }
+
+#ifdef MAP_HUGETLB
+    // Huge pages are committed up front by the kernel, so they are not combined with lazy commit.
+    if (options->pages == MEM_PAGES_HUGETLB && !options->lazy_commit) {
+        size_t huge_length = (length + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        pool = mmap(NULL, huge_length, prot, flags | MAP_HUGETLB, -1, 0);
+        if (pool != MAP_FAILED) {
+            length = huge_length;
+        }
+    }
+#endif
+
+    // No reserved huge pages (or not asked for them): fall back to normal pages.
+    if (pool == MAP_FAILED) {
+        pool = mmap(NULL, length, prot, flags, -1, 0);
+        if (pool == MAP_FAILED) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (options->pages != MEM_PAGES_DEFAULT) {
+            madvise(pool, length, MADV_HUGEPAGE); // Only a hint; ignored without THP support
+        }
+#endif
+    }
+
+    *mapped_size = length;
+    return pool;
+}
+
+// Makes the arena usable up to at least end, a granule at a time. Fails when the OS refuses the commit.
+// Caller holds arena->lock.
+bool os_commit(Mem_Arena* arena, char* end) {
+    if (end <= arena->committed_end) {
+        return true;
+    }
+
+    char* arena_end = arena->base + arena->size;
+    char* new_end = arena->committed_end + COMMIT_GRANULE;
+    if (new_end < end) {
+        new_end = end;
+    }
+    if (new_end > arena_end) {
+        new_end = arena_end;
+    }
+
+    // Neighbouring arenas may share a page at their boundary; committing it twice is harmless.
+    uintptr_t mask = page_size() - 1;
+    uintptr_t start = (uintptr_t)arena->committed_end & ~mask;
+    uintptr_t stop = ((uintptr_t)new_end + mask) & ~mask;
+    if (mprotect((void*)start, stop - start, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    if (arena->populate_on_commit) {
+        os_populate((char*)start, (char*)stop);
+    }
+    arena->committed_end = new_end;
+    return true;
+}
+
+// Faults in [start, end) for writing without changing its contents. Returns false when the kernel
+// does not support it (before Linux 5.14).
+bool os_populate(char* start, char* end) {
+    uintptr_t mask = page_size() - 1;
+    uintptr_t from = (uintptr_t)start & ~mask;
+    uintptr_t to = ((uintptr_t)end + mask) & ~mask;
+    return from >= to || madvise((void*)from, to - from, MADV_POPULATE_WRITE) == 0;
+}
+
+void os_unmap_pool(void* pool, size_t mapped_size) {
+    munmap(pool, mapped_size);
+}
+
+// Hands the whole pages of [from, to) inside a free block back to the OS. Callers pass the part of the
+// block that has not been released before, so pages are not advised again every time a neighbour is freed.
+void os_release_free_pages(Mem_Arena* arena, Memory_Block* block, char* from, char* to) {
+    if (arena->release_threshold == 0 || block->size < arena->release_threshold) {
+        return;
+    }
+
+    uintptr_t mask = page_size() - 1;
+    uintptr_t block_start = (uintptr_t)block->pnt;
+    uintptr_t block_end = block_start + block->size;
+
+    // Whole pages of the block that overlap [from, to).
+    uintptr_t start = (uintptr_t)from & ~mask;
+    uintptr_t end = ((uintptr_t)to + mask) & ~mask;
+    if (start < ((block_start + mask) & ~mask)) {
+        start = (block_start + mask) & ~mask;
+    }
+    if (end > (block_end & ~mask)) {
+        end = block_end & ~mask;
+    }
+    if (start >= end) {
+        return;
+    }
+
+#ifdef MADV_FREE
+    // MADV_FREE lets the kernel reclaim lazily; kernels before 4.5 reject it.
+    if (arena->release_lazy && madvise((void*)start, end - start, MADV_FREE) == 0) {
+        return;
+    }
+#endif
+    madvise((void*)start, end - start, MADV_DONTNEED);
+}
+
+// Reads the online NUMA nodes ("0-1,3" in sysfs) into nodes. Returns how many there are, 0 when the
+// kernel does not say (no NUMA support, or sysfs not mounted).
+int os_numa_nodes(int* nodes, int max) {
+    FILE* file = fopen("/sys/devices/system/node/online", "r");
+    if (file == NULL) {
+        return 0;
+    }
+    int count = 0;
+    int first;
+    int last;
+    char separator = ',';
+    while (separator == ',' && fscanf(file, "%d", &first) == 1) {
+        last = first;
+        if (fscanf(file, "%c", &separator) == 1 && separator == '-') {
+            if (fscanf(file, "%d", &last) != 1) {
+                break;
+            }
+            if (fscanf(file, "%c", &separator) != 1) {
+                separator = '\n';
+            }
+        }
+        for (int node = first; node <= last && count < max; node++) {
+            nodes[count++] = node;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+// getcpu came with glibc 2.29. __GLIBC_PREREQ only exists on glibc, so it cannot share the #if with
+// the defined() test.
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 29)
+#define HAVE_GETCPU
+#endif
+#endif
+
+// The NUMA node the calling thread runs on, or -1 when it cannot be told.
+int os_current_node(void) {
+    unsigned int cpu;
+    unsigned int node;
+#ifdef HAVE_GETCPU
+    // Served from the vDSO on x86-64, so it is cheap enough for every allocation.
+    if (getcpu(&cpu, &node) != 0) {
+        return -1;
+    }
+#else
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+        return -1;
+    }
+#endif
+    return (int)node;
+}
+
+// Places the whole pages of [start, start + size) on node, moving pages that were faulted in already
+// (e.g. by MAP_POPULATE). The node is preferred rather than required: when it runs out of memory the
+// kernel falls back to another node instead of failing the page fault. A negative node restores the
+// default policy. False when the kernel refuses, e.g. without NUMA support.
+bool os_bind_node(char* start, size_t size, int node) {
+    uintptr_t mask = page_size() - 1;
+    uintptr_t from = ((uintptr_t)start + mask) & ~mask;
+    uintptr_t to = ((uintptr_t)start + size) & ~mask;
+    if (from >= to) {
+        return true;
+    }
+
+    unsigned long nodemask[16] = {0}; // Room for 1024 nodes
+    int max_node = (int)(sizeof(nodemask) * 8);
+    if (node >= max_node) {
+        return false;
+    }
+    if (node >= 0) {
+        nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    }
+    int mode = node >= 0 ? MPOL_PREFERRED : MPOL_DEFAULT;
+    return syscall(SYS_mbind, (void*)from, to - from, mode, node >= 0 ? nodemask : NULL, node >= 0 ? max_node + 1 : 0,
+                   node >= 0 ? MPOL_MF_MOVE : 0) == 0;
+}
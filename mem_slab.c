@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory_manager.h"
+
+// Objects are numbered 0..count-1; SLAB_EMPTY marks the end of the free stack.
+#define SLAB_EMPTY UINT32_MAX
+
+// The free stack head packs a 32-bit version tag above the index of the top object.
+// Every successful push or pop bumps the tag, so a stale head can never be CAS'd back (ABA).
+#define HEAD_INDEX(head) ((uint32_t)(head))
+#define HEAD_TAG(head) ((uint32_t)((head) >> 32))
+#define MAKE_HEAD(tag, index) (((uint64_t)(tag) << 32) | (uint32_t)(index))
+
+struct mem_slab {
+    uint64_t head;        // Tagged index of the first free object
+    mem_pool_t* pool;
+    char* objects;        // Region carved from the pool with a single allocation
+    size_t obj_size;
+    uint32_t count;
+    uint32_t* next_free;  // Next free object after each free one, kept outside the objects
+    bool* live;           // Whether each object is handed out; catches double frees
+};
+
+mem_slab_t* mem_slab_create(size_t obj_size, size_t count) {
+    return mem_pool_slab_create(mem_default_pool(), obj_size, count);
+}
+
+mem_slab_t* mem_pool_slab_create(mem_pool_t* pool, size_t obj_size, size_t count) {
+    if (obj_size == 0 || count == 0 || count >= SLAB_EMPTY || obj_size > SIZE_MAX / count) {
+        return NULL;
+    }
+
+    mem_slab_t* slab = calloc(1, sizeof(mem_slab_t));
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->pool = pool;
+    slab->objects = mem_pool_alloc(pool, obj_size * count);
+    slab->next_free = malloc(count * sizeof(uint32_t));
+    slab->live = calloc(count, sizeof(bool));
+    if (slab->objects == NULL || slab->next_free == NULL || slab->live == NULL) {
+        mem_slab_destroy(slab);
+        return NULL;
+    }
+
+    slab->obj_size = obj_size;
+    slab->count = (uint32_t)count;
+    for (uint32_t i = 0; i < slab->count; i++) {
+        slab->next_free[i] = i + 1 < slab->count ? i + 1 : SLAB_EMPTY;
+    }
+    slab->head = MAKE_HEAD(0, 0);
+    return slab;
+}
+
+void* mem_slab_alloc(mem_slab_t* slab) {
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    uint64_t head = __atomic_load_n(&slab->head, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        uint32_t index = HEAD_INDEX(head);
+        if (index == SLAB_EMPTY) {
+            return NULL;
+        }
+        // May read a link that is already stale; the tag makes the CAS below fail in that case.
+        uint32_t next = __atomic_load_n(&slab->next_free[index], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&slab->head, &head, MAKE_HEAD(HEAD_TAG(head) + 1, next),
+                                        true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&slab->live[index], true, __ATOMIC_RELAXED);
+            return slab->objects + (size_t)index * slab->obj_size;
+        }
+    }
+}
+
+void mem_slab_free(mem_slab_t* slab, void* ptr) {
+    if (slab == NULL || ptr == NULL) {
+        return;
+    }
+
+    // Pointers outside the slab, into the middle of an object, or already freed are ignored.
+    char* object = ptr;
+    if (object < slab->objects || object >= slab->objects + (size_t)slab->count * slab->obj_size) {
+        return;
+    }
+    size_t offset = (size_t)(object - slab->objects);
+    if (offset % slab->obj_size != 0) {
+        return;
+    }
+    uint32_t index = (uint32_t)(offset / slab->obj_size);
+    if (!__atomic_exchange_n(&slab->live[index], false, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    uint64_t head = __atomic_load_n(&slab->head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&slab->next_free[index], HEAD_INDEX(head), __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&slab->head, &head, MAKE_HEAD(HEAD_TAG(head) + 1, index),
+                                          true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void mem_slab_destroy(mem_slab_t* slab) {
+    if (slab == NULL) {
+        return;
+    }
+    if (slab->objects != NULL) {
+        mem_pool_free_sized(slab->pool, slab->objects, slab->obj_size * slab->count);
+    }
+    free(slab->next_free);
+    free(slab->live);
+    free(slab);
+}
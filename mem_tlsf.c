@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory_manager_internal.h"
+
+// Two-Level Segregated Fit: the first level is floor(log2(size)), the second level splits that range
+// into TLSF_SL_COUNT equal sub-ranges. Splitting and coalescing are shared with the segregated
+// backend; only the free-list structure differs, and every operation on it is O(1).
+
+static void mapping(size_t size, int* fl, int* sl) {
+    *fl = size_class(size);
+    if (*fl >= TLSF_SL_BITS) {
+        *sl = (int)(size >> (*fl - TLSF_SL_BITS)) ^ TLSF_SL_COUNT;
+    } else {
+        *sl = (int)(size << (TLSF_SL_BITS - *fl)) ^ TLSF_SL_COUNT;
+    }
+}
+
+void tlsf_insert(Mem_Arena* arena, Memory_Block* block) {
+    int fl, sl;
+    mapping(block->size, &fl, &sl);
+
+    Memory_Block** head = &arena->tlsf_lists[fl][sl];
+    block->free_prev = NULL;
+    block->free_next = *head;
+    if (*head != NULL) {
+        (*head)->free_prev = block;
+    }
+    *head = block;
+    arena->tlsf_sl_bitmap[fl] |= 1U << sl;
+    arena->free_class_bitmap |= 1ULL << fl;
+}
+
+void tlsf_remove(Mem_Arena* arena, Memory_Block* block) {
+    int fl, sl;
+    mapping(block->size, &fl, &sl);
+
+    if (block->free_prev != NULL) {
+        block->free_prev->free_next = block->free_next;
+    } else {
+        arena->tlsf_lists[fl][sl] = block->free_next;
+    }
+    if (block->free_next != NULL) {
+        block->free_next->free_prev = block->free_prev;
+    }
+    block->free_prev = NULL;
+    block->free_next = NULL;
+
+    if (arena->tlsf_lists[fl][sl] == NULL) {
+        arena->tlsf_sl_bitmap[fl] &= ~(1U << sl);
+        if (arena->tlsf_sl_bitmap[fl] == 0) {
+            arena->free_class_bitmap &= ~(1ULL << fl);
+        }
+    }
+}
+
+// Rounds the request up to the next sub-class boundary, so the head of any non-empty list at or
+// above it fits without scanning.
+Memory_Block* tlsf_find(Mem_Arena* arena, size_t size) {
+    int fl, sl;
+    size_t rounded = size;
+    if (size_class(size) >= TLSF_SL_BITS) {
+        size_t step = ((size_t)1 << (size_class(size) - TLSF_SL_BITS)) - 1;
+        rounded = size <= SIZE_MAX - step ? size + step : size;
+    }
+    mapping(rounded, &fl, &sl);
+
+    uint32_t sl_map = arena->tlsf_sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        uint64_t fl_map = fl < NUM_SIZE_CLASSES - 1 ? arena->free_class_bitmap & (~0ULL << (fl + 1)) : 0;
+        if (fl_map != 0) {
+            fl = __builtin_ctzll(fl_map);
+            sl_map = arena->tlsf_sl_bitmap[fl];
+        }
+    }
+    if (sl_map != 0) {
+        return arena->tlsf_lists[fl][__builtin_ctz(sl_map)];
+    }
+
+    // Nothing strictly larger is free; the head of the request's own sub-class may still fit.
+    mapping(size, &fl, &sl);
+    Memory_Block* head = arena->tlsf_lists[fl][sl];
+    return head != NULL && head->size >= size ? head : NULL;
+}
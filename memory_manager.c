@@ -1,170 +1,2145 @@
+#define _GNU_SOURCE // For sched_getcpu
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
-#include "memory_manager.h"
+#include <sched.h>
+#include <time.h>
+#include "memory_manager_internal.h"
 
-pthread_mutex_t memory_mutex = PTHREAD_MUTEX_INITIALIZER;
+// The default pool behind mem_init/mem_alloc/mem_free; these globals describe it for older callers.
+void* memory_pool = NULL;
+Memory_Block* block_pool = NULL;
 
-void* memory_pool = NULL;   
-Memory_Block* block_pool = NULL;      
+int memory_pool_size = 0;
 
-int memory_pool_size = 0;      
-int total_memory_allocated = 0;
+static mem_pool_t* default_pool = NULL;
 
-void mem_init(size_t size) {
-    pthread_mutex_lock(&memory_mutex);
+// A growable pool adds chunks as extra arenas once its memory is exhausted. Each chunk is as large as
+// the whole pool at that point, so the pool doubles; empty chunks are handed back when their last block is freed.
+#define MAX_GROWTH_CHUNKS 64
+#define MIN_GROWTH_CHUNK (64 * 1024)
+#define MAX_NUMA_NODES 64
+#define MIN_NODE_SIZE (64 * 1024) // Smaller pools are not split across NUMA nodes
+
+// Allocated blocks are indexed by start address so mem_free and mem_resize find them in O(1).
+// The index is split into stripes with their own rwlock, so arenas do not serialise on it and
+// the thread cache can read it without taking any arena lock.
+#define INDEX_STRIPE_BITS 4
+#define INDEX_STRIPES (1 << INDEX_STRIPE_BITS)
+#define INDEX_INITIAL_BITS 8
+
+typedef struct Index_Stripe {
+    pthread_rwlock_t lock;
+    Memory_Block** buckets;
+    int bits;
+    size_t count;
+} Index_Stripe;
+
+typedef struct Thread_Cache Thread_Cache;
+
+// Counters each thread keeps for itself; mem_stats adds them up. Only the owning thread writes them.
+typedef struct Thread_Stats {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failed_allocs;
+} Thread_Stats;
+
+// Everything one pool owns. Pools share nothing but the round-robin ticket below, so independent
+// pools never contend with each other.
+struct mem_pool {
+    void* memory;                   // The pool's initial region, sliced into the home arenas
+    size_t size;
+    size_t mapped_size;             // Length of the mapping when memory came from mmap, else 0
+    mem_options_t options;
+    size_t alignment;               // Every block starts at a multiple of this and its size is one too
+
+    Mem_Arena* arenas;
+    int num_arenas;                 // Arenas in use, including growth chunks; only ever increases
+    int num_home_arenas;            // The first arenas, which slice memory and are assigned to threads
+    int num_nodes;                  // MEM_ARENA_PER_NODE: nodes the home arenas are bound to, 0 when not bound
+    int nodes[MAX_NUMA_NODES];      // Their ids; the home arenas of nodes[i] are the i-th equal group
+    int arena_capacity;
+
+    pthread_mutex_t grow_mutex;
+    size_t total_size;              // memory plus live chunks
+    unsigned int generation;        // Bumped whenever a chunk is added
+
+    Index_Stripe index[INDEX_STRIPES];
+
+    bool cache_key_created;
+    pthread_key_t cache_key;        // This thread's Thread_Cache for the pool
+    pthread_mutex_t cache_list_mutex; // Lock order: cache_list_mutex, cache->lock, arena->lock
+    Thread_Cache* cache_list;       // Caches of exited threads stay on it until a new thread takes them over
+
+    pthread_t prefault_thread;
+    bool prefault_running;
+    bool prefault_stop;
+};
+
+static unsigned int arena_ticket = 0;   // Next round-robin assignment
+static __thread int thread_ticket = -1; // This thread's round-robin assignment
+
+Memory_Block* new_descriptor(Mem_Arena* arena) {
+    if (arena->spare_descriptors == NULL) {
+        Descriptor_Chunk* chunk = malloc(sizeof(Descriptor_Chunk));
+        if (chunk == NULL) {
+            return NULL;
+        }
+        // Any descriptor may end up as a free block, and next-fit's table has a slot for each.
+        if (arena->fit == MEM_FIT_NEXT && !free_table_grow(&arena->free_table, DESCRIPTORS_PER_CHUNK)) {
+            free(chunk);
+            return NULL;
+        }
+        chunk->next = arena->descriptor_chunks;
+        arena->descriptor_chunks = chunk;
+
+        for (int i = 0; i < DESCRIPTORS_PER_CHUNK; i++) {
+            chunk->blocks[i].free_next = arena->spare_descriptors;
+            arena->spare_descriptors = &chunk->blocks[i];
+        }
+    }
+
+    Memory_Block* block = arena->spare_descriptors;
+    arena->spare_descriptors = block->free_next;
+    block->index_next = NULL;
+    block->cached = false;
+    __atomic_store_n(&block->run, NULL, __ATOMIC_RELAXED); // Lookups may read it without the arena lock
+    block->owner = NULL;
+    block->arena = arena;
+    return block;
+}
+
+void release_descriptor(Mem_Arena* arena, Memory_Block* block) {
+    // A released block was merged into its predecessor, which takes over as the next-fit start.
+    if (arena->rover == block) {
+        arena->rover = block->prev;
+    }
+    block->free_next = arena->spare_descriptors;
+    arena->spare_descriptors = block;
+}
+
+static void release_descriptor_chunks(Mem_Arena* arena) {
+    while (arena->descriptor_chunks != NULL) {
+        Descriptor_Chunk* next_chunk = arena->descriptor_chunks->next;
+        free(arena->descriptor_chunks);
+        arena->descriptor_chunks = next_chunk;
+    }
+    arena->spare_descriptors = NULL;
+    free_table_release(&arena->free_table);
+}
+
+static uint64_t index_hash(void* pnt) {
+    return (uint64_t)(uintptr_t)pnt * 0x9E3779B97F4A7C15ULL;
+}
+
+static Index_Stripe* index_stripe(mem_pool_t* pool, void* pnt) {
+    return &pool->index[index_hash(pnt) >> (64 - INDEX_STRIPE_BITS)];
+}
+
+static size_t index_slot(void* pnt, int bits) {
+    return (size_t)((index_hash(pnt) << INDEX_STRIPE_BITS) >> (64 - bits));
+}
+
+static bool index_init(mem_pool_t* pool) {
+    for (int i = 0; i < INDEX_STRIPES; i++) {
+        Index_Stripe* stripe = &pool->index[i];
+        pthread_rwlock_init(&stripe->lock, NULL);
+        stripe->buckets = calloc((size_t)1 << INDEX_INITIAL_BITS, sizeof(Memory_Block*));
+        stripe->bits = INDEX_INITIAL_BITS;
+        stripe->count = 0;
+        if (stripe->buckets == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void index_destroy(mem_pool_t* pool) {
+    for (int i = 0; i < INDEX_STRIPES; i++) {
+        Index_Stripe* stripe = &pool->index[i];
+        if (stripe->buckets != NULL) {
+            free(stripe->buckets);
+            stripe->buckets = NULL;
+            stripe->count = 0;
+            pthread_rwlock_destroy(&stripe->lock);
+        }
+    }
+}
+
+static void index_grow(Index_Stripe* stripe) {
+    int bits = stripe->bits + 1;
+    Memory_Block** buckets = calloc((size_t)1 << bits, sizeof(Memory_Block*));
+    if (buckets == NULL) {
+        return; // Keep the current table; chains just get longer.
+    }
+
+    for (size_t i = 0; i < ((size_t)1 << stripe->bits); i++) {
+        Memory_Block* current = stripe->buckets[i];
+        while (current != NULL) {
+            Memory_Block* next_block = current->index_next;
+            size_t slot = index_slot(current->pnt, bits);
+            current->index_next = buckets[slot];
+            buckets[slot] = current;
+            current = next_block;
+        }
+    }
+
+    free(stripe->buckets);
+    stripe->buckets = buckets;
+    stripe->bits = bits;
+}
+
+void index_insert(Memory_Block* block) {
+    Index_Stripe* stripe = index_stripe(block->arena->pool, block->pnt);
+
+    pthread_rwlock_wrlock(&stripe->lock);
+    if (stripe->count >= ((size_t)1 << stripe->bits)) {
+        index_grow(stripe);
+    }
+    size_t slot = index_slot(block->pnt, stripe->bits);
+    block->index_next = stripe->buckets[slot];
+    stripe->buckets[slot] = block;
+    stripe->count++;
+    pthread_rwlock_unlock(&stripe->lock);
+}
+
+static Memory_Block* index_find(mem_pool_t* pool, void* pnt) {
+    Index_Stripe* stripe = index_stripe(pool, pnt);
+
+    pthread_rwlock_rdlock(&stripe->lock);
+    Memory_Block* current = NULL;
+    if (stripe->buckets != NULL) {
+        current = stripe->buckets[index_slot(pnt, stripe->bits)];
+        while (current != NULL && current->pnt != pnt) {
+            current = current->index_next;
+        }
+    }
+    pthread_rwlock_unlock(&stripe->lock);
+    return current;
+}
+
+void index_remove(Memory_Block* block) {
+    Index_Stripe* stripe = index_stripe(block->arena->pool, block->pnt);
+
+    pthread_rwlock_wrlock(&stripe->lock);
+    Memory_Block** link = &stripe->buckets[index_slot(block->pnt, stripe->bits)];
+    while (*link != NULL && *link != block) {
+        link = &(*link)->index_next;
+    }
+    if (*link != NULL) {
+        *link = block->index_next;
+        block->index_next = NULL;
+        stripe->count--;
+    }
+    pthread_rwlock_unlock(&stripe->lock);
+}
+
+int size_class(size_t size) {
+    return 63 - __builtin_clzll((unsigned long long)size);
+}
+
+void free_list_insert(Mem_Arena* arena, Memory_Block* block) {
+    if (arena->backend == MEM_BACKEND_TLSF) {
+        tlsf_insert(arena, block);
+        return;
+    }
+    if (arena->fit == MEM_FIT_BEST || arena->fit == MEM_FIT_ADDRESS) {
+        fit_tree_insert(arena, block);
+        return;
+    }
+    if (arena->fit == MEM_FIT_NEXT) {
+        free_table_insert(&arena->free_table, block);
+        return;
+    }
+
+    int cls = size_class(block->size);
+
+    block->free_prev = NULL;
+    block->free_next = arena->free_lists[cls];
+    if (arena->free_lists[cls] != NULL) {
+        arena->free_lists[cls]->free_prev = block;
+    }
+    arena->free_lists[cls] = block;
+    arena->free_class_bitmap |= 1ULL << cls;
+}
+
+void free_list_remove(Mem_Arena* arena, Memory_Block* block) {
+    if (arena->backend == MEM_BACKEND_TLSF) {
+        tlsf_remove(arena, block);
+        return;
+    }
+    if (arena->fit == MEM_FIT_BEST || arena->fit == MEM_FIT_ADDRESS) {
+        fit_tree_remove(arena, block);
+        return;
+    }
+    if (arena->fit == MEM_FIT_NEXT) {
+        free_table_remove(&arena->free_table, block);
+        return;
+    }
+
+    int cls = size_class(block->size);
+
+    if (block->free_prev != NULL) {
+        block->free_prev->free_next = block->free_next;
+    } else {
+        arena->free_lists[cls] = block->free_next;
+    }
+    if (block->free_next != NULL) {
+        block->free_next->free_prev = block->free_prev;
+    }
+    block->free_prev = NULL;
+    block->free_next = NULL;
+
+    if (arena->free_lists[cls] == NULL) {
+        arena->free_class_bitmap &= ~(1ULL << cls);
+    }
+}
+
+static Memory_Block* find_free_block(Mem_Arena* arena, size_t size) {
+    if (arena->backend == MEM_BACKEND_TLSF) {
+        return tlsf_find(arena, size);
+    }
+    if (arena->fit == MEM_FIT_BEST || arena->fit == MEM_FIT_ADDRESS) {
+        return fit_tree_find(arena, size);
+    }
+    if (arena->fit == MEM_FIT_NEXT) {
+        return next_fit_find(arena, size);
+    }
+
+    int cls = size_class(size);
+
+    // Every block in class cls is at least 2^cls, so a power-of-two request fits the head.
+    if ((size & (size - 1)) == 0 && arena->free_lists[cls] != NULL) {
+        return arena->free_lists[cls];
+    }
+
+    // Every block in a higher class is larger than size; take the smallest such class.
+    uint64_t larger = cls < NUM_SIZE_CLASSES - 1 ? arena->free_class_bitmap & (~0ULL << (cls + 1)) : 0;
+    if (larger != 0) {
+        return arena->free_lists[__builtin_ctzll(larger)];
+    }
+
+    // Only the request's own class can still hold a fit.
+    for (Memory_Block* current = arena->free_lists[cls]; current != NULL; current = current->free_next) {
+        if (current->size >= size) {
+            return current;
+        }
+    }
+    return NULL;
+}
+
+// Bytes from pnt up to the next multiple of alignment (a power of two).
+static size_t align_gap(void* pnt, size_t alignment) {
+    return (size_t)(-(uintptr_t)pnt & (alignment - 1));
+}
+
+// Cuts block in two at offset; the upper part gets a new descriptor and is returned. Neither part is
+// on the free lists. Returns NULL, leaving block untouched, when out of descriptors.
+static Memory_Block* split_block(Mem_Arena* arena, Memory_Block* block, size_t offset) {
+    Memory_Block* upper = new_descriptor(arena);
+    if (upper == NULL) {
+        return NULL;
+    }
+    upper->pnt = (char*)block->pnt + offset;
+    upper->size = block->size - offset;
+    upper->free = block->free;
+    upper->next = block->next;
+    upper->prev = block;
+    if (block->next != NULL) {
+        block->next->prev = upper;
+    }
+    block->size = offset;
+    block->next = upper;
+    arena->splits++;
+    return upper;
+}
+
+// Takes a free block of at least size bytes starting at a multiple of alignment off the free lists.
+// A misaligned head is left behind as a free block and the remainder is split off the tail.
+// Caller holds arena->lock.
+static Memory_Block* take_free_block(Mem_Arena* arena, size_t size, size_t alignment) {
+    if (arena->backend == MEM_BACKEND_BUDDY) {
+        // Buddy blocks are aligned to their own size, counted from the arena start.
+        if (align_gap(arena->base, alignment) != 0) {
+            return buddy_allocate_aligned(arena, size, alignment);
+        }
+        return buddy_allocate_block(arena, size > alignment ? size : alignment);
+    }
+
+    Memory_Block* current = find_free_block(arena, size);
+    if (current != NULL && align_gap(current->pnt, alignment) > current->size - size) {
+        // The first fit has no room for the padding; any block this much larger does.
+        current = size <= SIZE_MAX - alignment ? find_free_block(arena, size + alignment - 1) : NULL;
+    }
+    if (current == NULL) {
+        return NULL;
+    }
+
+    free_list_remove(arena, current);
+    size_t gap = align_gap(current->pnt, alignment);
+    if (gap > 0) {
+        Memory_Block* aligned = split_block(arena, current, gap);
+        free_list_insert(arena, current);
+        if (aligned == NULL) {
+            printf("No block allocated\n");
+            return NULL;
+        }
+        current = aligned;
+    }
+
+    if (current->size > size) {
+        Memory_Block* rest = split_block(arena, current, size);
+        if (rest == NULL) {
+            printf("No block allocated\n");
+            if (gap > 0) {
+                // Give the aligned part back to the padding block it was cut from.
+                Memory_Block* head = current->prev;
+                free_list_remove(arena, head);
+                head->size += current->size;
+                head->next = current->next;
+                if (current->next != NULL) {
+                    current->next->prev = head;
+                }
+                release_descriptor(arena, current);
+                free_list_insert(arena, head);
+            } else {
+                free_list_insert(arena, current);
+            }
+            return NULL;
+        }
+        free_list_insert(arena, rest);
+    }
+
+    current->free = false;
+    index_insert(current);
+    arena->allocated += current->size;
+    arena->rover = current->next;
+    return current;
+}
+
+static void free_block(Memory_Block* current);
+
+// Like take_free_block, but also commits a lazily committed arena up to the end of the block.
+// Caller holds arena->lock.
+static Memory_Block* allocate_block(Mem_Arena* arena, size_t size, size_t alignment) {
+    Memory_Block* block = take_free_block(arena, size, alignment);
+    if (block != NULL && !os_commit(arena, (char*)block->pnt + block->size)) {
+        free_block(block);
+        return NULL;
+    }
+    return block;
+}
+
+// Returns an allocated block to the free lists, merging it with free neighbours.
+// Caller holds the lock of the block's arena.
+static void free_block(Memory_Block* current) {
+    Mem_Arena* arena = current->arena;
+    current->owner = NULL;
+    if (arena->backend == MEM_BACKEND_BUDDY) {
+        buddy_free_block(current);
+        return;
+    }
+
+    index_remove(current);
+    arena->allocated -= current->size;
+    current->free = true;
+
+    // Pages of a free neighbour that was already large enough have been released before.
+    char* release_from = current->pnt;
+    char* release_to = (char*)current->pnt + current->size;
+
+    // Neighbours are never both free, so one step each way restores the invariant.
+    Memory_Block* next_block = current->next;
+    if (next_block != NULL && next_block->free) {
+        if (next_block->size < arena->release_threshold) {
+            release_to += next_block->size;
+        }
+        free_list_remove(arena, next_block);
+        current->size += next_block->size;
+        current->next = next_block->next;
+        if (next_block->next != NULL) {
+            next_block->next->prev = current;
+        }
+        release_descriptor(arena, next_block);
+        arena->merges++;
+    }
+
+    Memory_Block* prev_block = current->prev;
+    if (prev_block != NULL && prev_block->free) {
+        if (prev_block->size < arena->release_threshold) {
+            release_from = prev_block->pnt;
+        }
+        free_list_remove(arena, prev_block);
+        prev_block->size += current->size;
+        prev_block->next = current->next;
+        if (current->next != NULL) {
+            current->next->prev = prev_block;
+        }
+        release_descriptor(arena, current);
+        arena->merges++;
+        current = prev_block;
+    }
+
+    free_list_insert(arena, current);
+    os_release_free_pages(arena, current, release_from, release_to);
+}
+
+static void release_chunk(Mem_Arena* arena);
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// Histogram bucket k holds durations in [2^k, 2^(k+1)) ns; the last bucket also takes everything longer.
+static int duration_bucket(uint64_t ns) {
+    int bucket = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+    return bucket < MEM_LOCK_HISTOGRAM_BUCKETS ? bucket : MEM_LOCK_HISTOGRAM_BUCKETS - 1;
+}
+
+// Takes arena->lock, timing the wait when another thread holds it. The uncontended path costs one trylock,
+// plus a clock read when the pool profiles its locks.
+static void arena_lock(Mem_Arena* arena) {
+    if (lock_try(&arena->lock)) {
+        if (arena->profile_locks) {
+            arena->lock_acquisitions++;
+            arena->locked_at = now_ns();
+        }
+        return;
+    }
+    uint64_t start = now_ns();
+    lock_acquire(&arena->lock);
+    uint64_t end = now_ns();
+    arena->lock_waits++;
+    arena->lock_wait_ns += end - start;
+    if (arena->profile_locks) {
+        arena->lock_acquisitions++;
+        arena->lock_wait_histogram[duration_bucket(end - start)]++;
+        arena->locked_at = end;
+    }
+}
+
+// Releases a lock taken with arena_lock, recording how long it was held.
+static void arena_unlock(Mem_Arena* arena) {
+    if (arena->profile_locks) {
+        uint64_t held = now_ns() - arena->locked_at;
+        arena->lock_hold_ns += held;
+        arena->lock_hold_histogram[duration_bucket(held)]++;
+    }
+    lock_release(&arena->lock);
+}
+
+// Frees a batch of blocks, taking each arena's lock once. The blocks of other arenas are moved to the
+// front of the array for the next round, so its contents are undefined afterwards.
+static void free_blocks(Memory_Block** blocks, int count) {
+    while (count > 0) {
+        Mem_Arena* arena = blocks[0]->arena;
+        int remaining = 0;
+        arena_lock(arena);
+        for (int i = 0; i < count; i++) {
+            if (blocks[i]->arena == arena) {
+                free_block(blocks[i]);
+            } else {
+                blocks[remaining++] = blocks[i];
+            }
+        }
+        if (arena->is_chunk && arena->allocated == 0) {
+            release_chunk(arena);
+        }
+        arena_unlock(arena);
+        count = remaining;
+    }
+}
+
+// Index of node in pool->nodes, or -1.
+static int node_index(mem_pool_t* pool, int node) {
+    for (int i = 0; i < pool->num_nodes; i++) {
+        if (pool->nodes[i] == node) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int home_arena(mem_pool_t* pool) {
+    if (pool->num_home_arenas <= 1) {
+        return 0;
+    }
+    if (pool->options.arena_assign == MEM_ARENA_PER_CPU) {
+        int cpu = sched_getcpu();
+        if (cpu >= 0) {
+            return cpu % pool->num_home_arenas;
+        }
+    }
+    if (thread_ticket < 0) {
+        thread_ticket = (int)(__atomic_fetch_add(&arena_ticket, 1, __ATOMIC_RELAXED) & 0x7fffffff);
+    }
+    // Round-robin within the group of the node the thread runs on, so that stealing visits the
+    // node's other arenas before it crosses to the next node.
+    if (pool->num_nodes > 1) {
+        int node = node_index(pool, os_current_node());
+        if (node >= 0) {
+            int per_node = pool->num_home_arenas / pool->num_nodes;
+            return node * per_node + thread_ticket % per_node;
+        }
+    }
+    return thread_ticket % pool->num_home_arenas;
+}
+
+// Per-thread, per-pool caches of recently freed blocks. A block in a cache stays allocated as far as
+// its arena is concerned, so an alloc/free pair on one thread never takes an arena lock.
+#define CACHE_NUM_CLASSES 16      // Only blocks smaller than 2^16 bytes are cached
+#define CACHE_BIN_CAPACITY 32
+#define CACHE_FLUSH_BATCH 16      // Oldest entries returned to the pool when a bin is full
+#define CACHE_REFILL_MAX_SIZE 256 // Small misses carve a batch of equal blocks in one locked pass
+#define CACHE_REFILL_BATCH 8
+
+// Blocks other threads free for the owner of a cache (with the remote_free option) are pushed onto its
+// remote_frees stack with one compare-and-swap and linked through free_next; the owner takes the whole
+// stack with another on its next allocation. Taking everything at once means there is no ABA problem.
+// An exited thread's stack holds REMOTE_CLOSED, which makes freeing threads take the ordinary path.
+#define REMOTE_CLOSED ((Memory_Block*)1)
+#define REMOTE_BATCH 64           // Uncacheable blocks from a remote stack are freed this many at a time
+
+struct Thread_Cache {
+    pthread_mutex_t lock; // Only contended when another thread reclaims this cache
+    int counts[CACHE_NUM_CLASSES];
+    Memory_Block* bins[CACHE_NUM_CLASSES][CACHE_BIN_CAPACITY];
+    Thread_Stats stats;
+    mem_pool_t* pool;
+    bool idle;            // The thread has exited and the cache awaits a new one; guarded by cache_list_mutex
+    Memory_Block* remote_frees;
+    uint64_t remote_blocks; // Size of remote_frees, for mem_stats
+    uint64_t remote_bytes;
+    struct Thread_Cache* next;
+};
+
+static void set_cached(Memory_Block* block, bool cached) {
+    __atomic_store_n(&block->cached, cached, __ATOMIC_RELAXED);
+}
+
+static bool is_cached(Memory_Block* block) {
+    return __atomic_load_n(&block->cached, __ATOMIC_RELAXED);
+}
+
+// Returns the oldest count blocks of a bin to their arenas. Caller holds cache->lock.
+static void cache_flush(Thread_Cache* cache, int cls, int count) {
+    Memory_Block** bin = cache->bins[cls];
+    for (int i = 0; i < count; i++) {
+        set_cached(bin[i], false);
+    }
+    free_blocks(bin, count);
+    memmove(&bin[0], &bin[count], (cache->counts[cls] - count) * sizeof(Memory_Block*));
+    cache->counts[cls] -= count;
+}
+
+static void cache_put(Thread_Cache* cache, int cls, Memory_Block* block) {
+    if (cache->counts[cls] == CACHE_BIN_CAPACITY) {
+        cache_flush(cache, cls, CACHE_FLUSH_BATCH);
+    }
+    set_cached(block, true);
+    cache->bins[cls][cache->counts[cls]++] = block;
+}
+
+// Pushes a block another thread allocated onto that thread's remote stack. False when the thread has exited.
+static bool remote_push(Thread_Cache* owner, Memory_Block* block) {
+    __atomic_fetch_add(&owner->remote_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&owner->remote_bytes, block->size, __ATOMIC_RELAXED);
+    Memory_Block* head = __atomic_load_n(&owner->remote_frees, __ATOMIC_RELAXED);
+    do {
+        if (head == REMOTE_CLOSED) {
+            __atomic_fetch_sub(&owner->remote_blocks, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&owner->remote_bytes, block->size, __ATOMIC_RELAXED);
+            return false;
+        }
+        block->free_next = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote_frees, &head, block, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return true;
+}
+
+// Moves the blocks on the cache's remote stack into its bins; blocks too large to cache go back to their
+// arenas in batches. With close, the stack stays closed afterwards. Caller holds cache->lock.
+static void remote_collect(Thread_Cache* cache, bool close) {
+    Memory_Block* list;
+    if (close) {
+        list = __atomic_exchange_n(&cache->remote_frees, REMOTE_CLOSED, __ATOMIC_ACQUIRE);
+    } else {
+        list = __atomic_load_n(&cache->remote_frees, __ATOMIC_RELAXED);
+        do {
+            if (list == NULL || list == REMOTE_CLOSED) {
+                return;
+            }
+        } while (!__atomic_compare_exchange_n(&cache->remote_frees, &list, NULL, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    }
+    if (list == REMOTE_CLOSED) {
+        return;
+    }
+
+    Memory_Block* large[REMOTE_BATCH];
+    int count = 0;
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;
+    while (list != NULL) {
+        Memory_Block* block = list;
+        list = block->free_next;
+        blocks++;
+        bytes += block->size;
+
+        int cls = size_class(block->size);
+        if (cls < CACHE_NUM_CLASSES) {
+            cache_put(cache, cls, block);
+            continue;
+        }
+        set_cached(block, false);
+        large[count++] = block;
+        if (count == REMOTE_BATCH) {
+            free_blocks(large, count);
+            count = 0;
+        }
+    }
+    if (count > 0) {
+        free_blocks(large, count);
+    }
+    __atomic_fetch_sub(&cache->remote_blocks, blocks, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&cache->remote_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// Returns every cached block to the pool. Caller holds cache->lock.
+static bool cache_drain(Thread_Cache* cache) {
+    bool drained = false;
+    for (int cls = 0; cls < CACHE_NUM_CLASSES; cls++) {
+        if (cache->counts[cls] > 0) {
+            cache_flush(cache, cls, cache->counts[cls]);
+            drained = true;
+        }
+    }
+    return drained;
+}
+
+// Empties the cache of an exiting thread. The cache itself stays on the pool's list, counters and all:
+// other threads may still hold it as the owner of blocks they are about to free.
+static void cache_destructor(void* arg) {
+    Thread_Cache* cache = arg;
+    mem_pool_t* pool = cache->pool;
+
+    pthread_mutex_lock(&cache->lock);
+    remote_collect(cache, true);
+    cache_drain(cache);
+    pthread_mutex_unlock(&cache->lock);
+
+    pthread_mutex_lock(&pool->cache_list_mutex);
+    cache->idle = true;
+    pthread_mutex_unlock(&pool->cache_list_mutex);
+}
+
+static Thread_Cache* get_thread_cache(mem_pool_t* pool) {
+    Thread_Cache* cache = pthread_getspecific(pool->cache_key);
+    if (cache != NULL) {
+        return cache;
+    }
+
+    // An exited thread's cache is taken over before a new one is made.
+    pthread_mutex_lock(&pool->cache_list_mutex);
+    for (cache = pool->cache_list; cache != NULL && !cache->idle; cache = cache->next) {
+    }
+    if (cache != NULL) {
+        cache->idle = false;
+        __atomic_store_n(&cache->remote_frees, NULL, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pool->cache_list_mutex);
+
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(Thread_Cache));
+        if (cache == NULL) {
+            return NULL;
+        }
+        pthread_mutex_init(&cache->lock, NULL);
+        cache->pool = pool;
+
+        pthread_mutex_lock(&pool->cache_list_mutex);
+        cache->next = pool->cache_list;
+        pool->cache_list = cache;
+        pthread_mutex_unlock(&pool->cache_list_mutex);
+    }
+
+    pthread_setspecific(pool->cache_key, cache);
+    return cache;
+}
+
+// Bumps a counter of the calling thread. Readers may race with it, so the store is atomic, but
+// there is only one writer and no read-modify-write instruction is needed.
+static void stat_add(uint64_t* counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+// Pops the most recently cached block that fits. Caller holds cache->lock.
+static Memory_Block* cache_take(Thread_Cache* cache, int cls, size_t size) {
+    Memory_Block** bin = cache->bins[cls];
+    for (int i = cache->counts[cls] - 1; i >= 0; i--) {
+        Memory_Block* block = bin[i];
+        if (block->size >= size) {
+            memmove(&bin[i], &bin[i + 1], (cache->counts[cls] - i - 1) * sizeof(Memory_Block*));
+            cache->counts[cls]--;
+            set_cached(block, false);
+            return block;
+        }
+    }
+    return NULL;
+}
+
+// Carves extra blocks of the same size for the next allocations. Caller holds cache->lock and arena->lock.
+static void cache_refill(Thread_Cache* cache, Mem_Arena* arena, int cls, size_t size) {
+    for (int i = 1; i < CACHE_REFILL_BATCH && cache->counts[cls] < CACHE_BIN_CAPACITY; i++) {
+        Memory_Block* block = allocate_block(arena, size, cache->pool->alignment);
+        if (block == NULL) {
+            return;
+        }
+        set_cached(block, true);
+        cache->bins[cls][cache->counts[cls]++] = block;
+    }
+}
+
+// Drains every thread's cache back into the pool; used when the pool looks exhausted.
+static bool reclaim_thread_caches(mem_pool_t* pool) {
+    bool reclaimed = false;
+
+    pthread_mutex_lock(&pool->cache_list_mutex);
+    for (Thread_Cache* cache = pool->cache_list; cache != NULL; cache = cache->next) {
+        pthread_mutex_lock(&cache->lock);
+        remote_collect(cache, false);
+        if (cache_drain(cache)) {
+            reclaimed = true;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    pthread_mutex_unlock(&pool->cache_list_mutex);
+
+    return reclaimed;
+}
+
+// Frees the caches of a pool that is torn down; the blocks in them go with the pool's memory.
+static void destroy_thread_caches(mem_pool_t* pool) {
+    pthread_key_delete(pool->cache_key);
+    while (pool->cache_list != NULL) {
+        Thread_Cache* next_cache = pool->cache_list->next;
+        pthread_mutex_destroy(&pool->cache_list->lock);
+        free(pool->cache_list);
+        pool->cache_list = next_cache;
+    }
+}
+
+// Allocates from the thread's home arena first, then steals from its siblings.
+// A non-NULL cache (whose lock the caller holds) is topped up from the home arena.
+static Memory_Block* arena_alloc(mem_pool_t* pool, size_t size, size_t alignment, Thread_Cache* cache, int cls) {
+    int home = home_arena(pool);
+    int count = __atomic_load_n(&pool->num_arenas, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; i++) {
+        Mem_Arena* arena = &pool->arenas[(home + i) % count];
+
+        arena_lock(arena);
+        Memory_Block* block = allocate_block(arena, size, alignment);
+        if (block != NULL && cache != NULL && i == 0 && size <= CACHE_REFILL_MAX_SIZE) {
+            cache_refill(cache, arena, cls, size);
+        }
+        arena_unlock(arena);
+
+        if (block != NULL) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+// Granule a small request is served from, or 0 when it takes an ordinary block. Granules are powers of
+// two inside a run aligned to BITMAP_RUN_SIZE, so each is aligned to its own size.
+static size_t bitmap_granule(mem_pool_t* pool, size_t size, size_t alignment) {
+    if (size > pool->options.small_block_threshold) {
+        return 0;
+    }
+    size_t granule = size <= ((size_t)1 << BITMAP_MIN_SHIFT) ? (size_t)1 << BITMAP_MIN_SHIFT : (size_t)1 << (64 - __builtin_clzll(size - 1));
+    if (granule < alignment) {
+        granule = alignment;
+    }
+    return granule <= ((size_t)1 << BITMAP_MAX_SHIFT) ? granule : 0;
+}
+
+// Takes a granule from a run with room, carving a new run when there is none. Like arena_alloc, the
+// home arena comes first. NULL when no arena has room for a run; the request then takes an ordinary block.
+static void* run_alloc(mem_pool_t* pool, size_t granule) {
+    int home = home_arena(pool);
+    int count = __atomic_load_n(&pool->num_arenas, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; i++) {
+        Mem_Arena* arena = &pool->arenas[(home + i) % count];
+
+        arena_lock(arena);
+        Bitmap_Run* run = arena->runs[bitmap_class(granule)];
+        if (run == NULL) {
+            Memory_Block* block = allocate_block(arena, BITMAP_RUN_SIZE, BITMAP_RUN_SIZE);
+            if (block != NULL && (run = bitmap_run_create(arena, block, granule)) == NULL) {
+                free_block(block);
+            }
+        }
+        void* ptr = run != NULL ? bitmap_take(arena, run) : NULL;
+        arena_unlock(arena);
+
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+// Gives an empty run's block back to its arena. Caller holds arena->lock.
+static void free_run(Mem_Arena* arena, Bitmap_Run* run) {
+    Memory_Block* block = run->block;
+    bitmap_run_destroy(arena, run);
+    free_block(block);
+    if (arena->is_chunk && arena->allocated == 0) {
+        release_chunk(arena);
+    }
+}
+
+// The run ptr lies in, with its arena locked, or NULL. A run's block starts at ptr rounded down to
+// BITMAP_RUN_SIZE. The index lookup runs without the arena lock, so the run may have been retired
+// (and its header reused) before the lock is taken; it is checked again under the lock. Run headers
+// and descriptors are never freed while the pool lives, so following the stale pointers is safe.
+static Bitmap_Run* lock_run(mem_pool_t* pool, void* ptr) {
+    if (pool == NULL || ptr == NULL || pool->options.small_block_threshold == 0) {
+        return NULL;
+    }
+    char* base = (char*)((uintptr_t)ptr & ~(uintptr_t)(BITMAP_RUN_SIZE - 1));
+    Memory_Block* block = index_find(pool, base);
+    Bitmap_Run* run = block != NULL ? __atomic_load_n(&block->run, __ATOMIC_ACQUIRE) : NULL;
+    if (run == NULL) {
+        return NULL;
+    }
+
+    arena_lock(run->arena);
+    if (run->block != NULL && run->base == base) {
+        return run;
+    }
+    arena_unlock(run->arena);
+    return NULL;
+}
+
+// Returns the granule at ptr and unlocks the run's arena. An empty run is given back unless it is the
+// last one of its granule, so alternating alloc/free does not carve and return runs.
+static void release_granule(mem_pool_t* pool, Bitmap_Run* run, void* ptr) {
+    Mem_Arena* arena = run->arena;
+    bool freed = bitmap_release(arena, run, ptr);
+    if (freed && run->used == 0 && (arena->runs[bitmap_class(run->granule)] != run || run->next != NULL)) {
+        free_run(arena, run);
+    }
+    arena_unlock(arena);
+
+    Thread_Cache* owner = freed ? get_thread_cache(pool) : NULL;
+    if (owner != NULL) {
+        stat_add(&owner->stats.frees, 1);
+    }
+}
+
+// Frees ptr if it lies in a run; false when it does not and the block path should handle it.
+static bool run_free(mem_pool_t* pool, void* ptr) {
+    Bitmap_Run* run = lock_run(pool, ptr);
+    if (run == NULL) {
+        return false;
+    }
+    release_granule(pool, run, ptr);
+    return true;
+}
+
+// Gives the blocks of all empty runs back to their arenas. True when there were any.
+static bool release_empty_runs(mem_pool_t* pool) {
+    if (pool->options.small_block_threshold == 0) {
+        return false;
+    }
+
+    bool released = false;
+    int count = __atomic_load_n(&pool->num_arenas, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        Mem_Arena* arena = &pool->arenas[i];
+        arena_lock(arena);
+        for (int cls = 0; cls < BITMAP_CLASSES; cls++) {
+            Bitmap_Run* run = arena->runs[cls];
+            while (run != NULL) {
+                Bitmap_Run* next = run->next;
+                if (run->used == 0) {
+                    free_run(arena, run);
+                    released = true;
+                }
+                run = next;
+            }
+        }
+        arena_unlock(arena);
+    }
+    return released;
+}
+
+// Lays out an empty arena over [base, base + size) for the pool's backend. Caller holds arena->lock
+// or has not published the arena yet.
+static bool arena_setup(mem_pool_t* pool, Mem_Arena* arena, char* base, size_t size) {
+    const mem_options_t* options = &pool->options;
+    arena->pool = pool;
+    arena->backend = options->backend;
+    arena->fit = options->backend == MEM_BACKEND_SEGREGATED ? options->fit : MEM_FIT_SIZE_CLASS;
+    arena->release_threshold = options->use_mmap ? options->release_threshold : 0;
+    arena->release_lazy = options->release_lazy;
+    arena->base = base;
+    arena->size = size;
+    arena->committed_end = options->lazy_commit ? base : base + size;
+    arena->populate_on_commit = options->lazy_commit && options->prefault == MEM_PREFAULT_POPULATE;
+    arena->profile_locks = options->profile_locks;
+    arena->node = -1;
+
+    if (arena->backend == MEM_BACKEND_BUDDY) {
+        return buddy_init_arena(arena);
+    }
+
+    arena->blocks = new_descriptor(arena);
+    if (arena->blocks == NULL) {
+        return false;
+    }
+    arena->blocks->pnt = arena->base;
+    arena->blocks->size = arena->size;
+    arena->blocks->free = true;
+    arena->blocks->next = NULL;
+    arena->blocks->prev = NULL;
+    if (arena->size > 0) {
+        free_list_insert(arena, arena->blocks);
+    }
+    return true;
+}
+
+// Returns an empty growth chunk's memory and leaves the arena slot free for the next chunk.
+// Caller holds arena->lock.
+static void release_chunk(Mem_Arena* arena) {
+    while (arena->blocks != NULL) {
+        Memory_Block* next_block = arena->blocks->next;
+        release_descriptor(arena, arena->blocks);
+        arena->blocks = next_block;
+    }
+    memset(arena->free_lists, 0, sizeof(arena->free_lists));
+    memset(arena->tlsf_lists, 0, sizeof(arena->tlsf_lists));
+    memset(arena->tlsf_sl_bitmap, 0, sizeof(arena->tlsf_sl_bitmap));
+    arena->free_class_bitmap = 0;
+    arena->free_tree = NULL;
+    arena->free_table.count = 0;
+    arena->free_table.holes = 0;
+    arena->rover = NULL;
+
+    if (arena->mapped_size > 0) {
+        os_unmap_pool(arena->base, arena->mapped_size);
+    } else {
+        free(arena->base);
+    }
+    __atomic_sub_fetch(&arena->pool->total_size, arena->size, __ATOMIC_RELAXED);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->mapped_size = 0;
+    arena->committed_end = NULL;
+}
+
+// Heap memory for a pool or a chunk, starting at a multiple of the pool's alignment.
+static void* heap_alloc(mem_pool_t* pool, size_t size) {
+    if (pool->alignment == 1) {
+        return malloc(size);
+    }
+    void* memory = NULL;
+    if (posix_memalign(&memory, pool->alignment > sizeof(void*) ? pool->alignment : sizeof(void*), size) != 0) {
+        return NULL;
+    }
+    return memory;
+}
+
+// Adds a chunk that can hold size bytes, unless another thread already grew the pool since
+// generation was read. Returns false when the ceiling or the OS refuses.
+static bool grow_pool(mem_pool_t* pool, size_t size, unsigned int generation) {
+    const mem_options_t* options = &pool->options;
+    if (!options->growable) {
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->grow_mutex);
+    if (__atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE) != generation) {
+        pthread_mutex_unlock(&pool->grow_mutex);
+        return true;
+    }
+
+    // A buddy chunk must contain a power-of-two block that fits the request; above 2^63 there is none.
+    size_t needed = size;
+    if (options->backend == MEM_BACKEND_BUDDY) {
+        if (size > (SIZE_MAX >> 1) + 1) {
+            pthread_mutex_unlock(&pool->grow_mutex);
+            return false;
+        }
+        needed = 8;
+        while (needed < size) {
+            needed *= 2;
+        }
+    }
+    size_t total = __atomic_load_n(&pool->total_size, __ATOMIC_RELAXED);
+    size_t chunk_size = total > needed ? total : needed;
+    if (chunk_size < MIN_GROWTH_CHUNK) {
+        chunk_size = MIN_GROWTH_CHUNK;
+    }
+    if (options->max_size > 0) {
+        if (total >= options->max_size || options->max_size - total < needed) {
+            pthread_mutex_unlock(&pool->grow_mutex);
+            return false;
+        }
+        if (chunk_size > options->max_size - total) {
+            chunk_size = options->max_size - total;
+        }
+    }
+
+    // Reuse the slot of a released chunk, or take a new one.
+    Mem_Arena* arena = NULL;
+    bool new_slot = false;
+    for (int i = pool->num_home_arenas; i < pool->num_arenas; i++) {
+        lock_acquire(&pool->arenas[i].lock);
+        if (pool->arenas[i].base == NULL) {
+            arena = &pool->arenas[i];
+            break;
+        }
+        lock_release(&pool->arenas[i].lock);
+    }
+    if (arena == NULL && pool->num_arenas < pool->arena_capacity) {
+        arena = &pool->arenas[pool->num_arenas];
+        lock_init(&arena->lock, options->lock);
+        lock_acquire(&arena->lock);
+        arena->is_chunk = true;
+        new_slot = true;
+    }
+
+    bool grown = false;
+    if (arena != NULL) {
+        char* base = options->use_mmap ? os_map_pool(chunk_size, options, &arena->mapped_size) : heap_alloc(pool, chunk_size);
+        if (base != NULL) {
+            __atomic_add_fetch(&pool->total_size, chunk_size, __ATOMIC_RELAXED);
+            grown = arena_setup(pool, arena, base, chunk_size);
+            if (!grown) {
+                release_chunk(arena);
+            } else if (pool->num_nodes > 1) {
+                // The chunk goes on the node of the thread that ran out of memory.
+                int node = os_current_node();
+                if (node_index(pool, node) >= 0 && os_bind_node(base, chunk_size, node)) {
+                    arena->node = node;
+                }
+            }
+        }
+        lock_release(&arena->lock);
+        if (new_slot) {
+            __atomic_store_n(&pool->num_arenas, pool->num_arenas + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (grown) {
+        __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pool->grow_mutex);
+    return grown;
+}
+
+// MEM_PREFAULT_BACKGROUND: a worker commits and faults in the home arenas a step at a time, taking
+// each arena's lock only for the commit so allocations are not held up by the page faults.
+#define PREFAULT_STEP ((size_t)2 << 20)
+
+static void* prefault_worker(void* arg) {
+    mem_pool_t* pool = arg;
+    for (int i = 0; i < pool->num_home_arenas; i++) {
+        Mem_Arena* arena = &pool->arenas[i];
+        char* end = arena->base + arena->size;
+        for (char* from = arena->base; from < end; from += PREFAULT_STEP) {
+            if (__atomic_load_n(&pool->prefault_stop, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+            char* to = (size_t)(end - from) > PREFAULT_STEP ? from + PREFAULT_STEP : end;
+            lock_acquire(&arena->lock);
+            bool committed = os_commit(arena, to);
+            lock_release(&arena->lock);
+            if (!committed || !os_populate(from, to)) {
+                return NULL; // Out of memory, or a kernel without MADV_POPULATE_WRITE: leave the rest to demand faults
+            }
+        }
+    }
+    return NULL;
+}
+
+static void stop_prefault(mem_pool_t* pool) {
+    if (pool->prefault_running) {
+        __atomic_store_n(&pool->prefault_stop, true, __ATOMIC_RELEASE);
+        pthread_join(pool->prefault_thread, NULL);
+        pool->prefault_running = false;
+    }
+}
+
+// Places each node's group of home arenas on that node. When the kernel refuses (no NUMA support,
+// or a sandbox without mbind) the pool is left unbound and threads are assigned round-robin.
+static void bind_home_arenas(mem_pool_t* pool) {
+    int per_node = pool->num_home_arenas / pool->num_nodes;
+    for (int i = 0; i < pool->num_nodes; i++) {
+        Mem_Arena* first = &pool->arenas[i * per_node];
+        Mem_Arena* last = &pool->arenas[(i + 1) * per_node - 1];
+        if (!os_bind_node(first->base, last->base + last->size - first->base, pool->nodes[i])) {
+            os_bind_node(pool->memory, pool->size, -1);
+            for (int j = 0; j < pool->num_home_arenas; j++) {
+                pool->arenas[j].node = -1;
+            }
+            pool->num_nodes = 0;
+            return;
+        }
+        for (Mem_Arena* arena = first; arena <= last; arena++) {
+            arena->node = pool->nodes[i];
+        }
+    }
+}
+
+mem_pool_t* mem_pool_create(size_t size, const mem_options_t* options) {
+    mem_options_t defaults = {0};
+    if (options == NULL) {
+        options = &defaults;
+    }
+    if ((options->alignment & (options->alignment - 1)) != 0) {
+        printf("Error: Alignment must be a power of two\n");
+        return NULL;
+    }
+
+    mem_pool_t* pool = calloc(1, sizeof(mem_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->options = *options;
+    if (pool->options.small_block_threshold > ((size_t)1 << BITMAP_MAX_SHIFT)) {
+        pool->options.small_block_threshold = (size_t)1 << BITMAP_MAX_SHIFT;
+    }
+    if (pool->options.lazy_commit || pool->options.arena_assign == MEM_ARENA_PER_NODE) {
+        pool->options.use_mmap = true;
+    }
+    options = &pool->options;
+    pool->alignment = options->alignment > 0 ? options->alignment : 1;
+    pool->size = size;
+    pool->total_size = size;
+    pthread_mutex_init(&pool->grow_mutex, NULL);
+    pthread_mutex_init(&pool->cache_list_mutex, NULL);
+
+    // Every arena needs at least one byte.
+    int count = options->arenas;
+    if (count < 1) {
+        count = 1;
+    }
+    // Every node gets the same number of arenas, and at least one.
+    if (options->arena_assign == MEM_ARENA_PER_NODE) {
+        pool->num_nodes = os_numa_nodes(pool->nodes, MAX_NUMA_NODES);
+        if (pool->num_nodes > 1 && size / pool->num_nodes >= MIN_NODE_SIZE) {
+            count = (count + pool->num_nodes - 1) / pool->num_nodes * pool->num_nodes;
+        } else {
+            pool->num_nodes = 0;
+        }
+    }
+    if (size > 0 && (size_t)count > size) {
+        count = (int)size;
+    }
+
+    if (options->use_mmap) {
+        pool->memory = os_map_pool(size, options, &pool->mapped_size);
+    } else {
+        pool->memory = heap_alloc(pool, size);
+    }
+    pool->arena_capacity = count + (options->growable ? MAX_GROWTH_CHUNKS : 0);
+    pool->arenas = calloc(pool->arena_capacity, sizeof(Mem_Arena));
+    pool->cache_key_created = pthread_key_create(&pool->cache_key, cache_destructor) == 0;
+
+    if (pool->memory == NULL || pool->arenas == NULL || !pool->cache_key_created || !index_init(pool)) {
+        mem_pool_destroy(pool);
+        return NULL;
+    }
+
+    // Slices start on the alignment too, so buddy arenas can hand out aligned blocks.
+    size_t slice = size / count;
+    if (slice >= pool->alignment) {
+        slice &= ~(pool->alignment - 1);
+    }
+    for (int i = 0; i < count; i++) {
+        lock_init(&pool->arenas[i].lock, pool->options.lock);
+        pool->num_arenas = i + 1;
+        if (!arena_setup(pool, &pool->arenas[i], (char*)pool->memory + i * slice, i == count - 1 ? size - i * slice : slice)) {
+            mem_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    pool->num_home_arenas = count;
+    if (pool->num_nodes > 1) {
+        bind_home_arenas(pool);
+    }
+
+    if (options->use_mmap && options->prefault == MEM_PREFAULT_BACKGROUND) {
+        pool->prefault_running = pthread_create(&pool->prefault_thread, NULL, prefault_worker, pool) == 0;
+    }
+    return pool;
+}
 
-    memory_pool = malloc(size);
-    block_pool = malloc(sizeof(Memory_Block));
+bool mem_pool_lock_profile(mem_pool_t* pool, mem_lock_profile_t* profile) {
+    memset(profile, 0, sizeof(*profile));
+    if (pool == NULL || !pool->options.profile_locks) {
+        return false;
+    }
 
-    if (memory_pool == NULL || block_pool == NULL) {
-        printf("Error: Memory pool allocation failed\n");
-        pthread_mutex_unlock(&memory_mutex);
+    int count = __atomic_load_n(&pool->num_arenas, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        Mem_Arena* arena = &pool->arenas[i];
+        // A plain lock, so reading the profile does not show up in it.
+        lock_acquire(&arena->lock);
+        profile->acquisitions += arena->lock_acquisitions;
+        profile->contended += arena->lock_waits;
+        profile->wait_ns += arena->lock_wait_ns;
+        profile->hold_ns += arena->lock_hold_ns;
+        for (int k = 0; k < MEM_LOCK_HISTOGRAM_BUCKETS; k++) {
+            profile->wait_histogram[k] += arena->lock_wait_histogram[k];
+            profile->hold_histogram[k] += arena->lock_hold_histogram[k];
+        }
+        lock_release(&arena->lock);
+    }
+    return true;
+}
+
+static void print_histogram(const char* name, const uint64_t* histogram) {
+    printf("  %s:\n", name);
+    for (int k = 0; k < MEM_LOCK_HISTOGRAM_BUCKETS; k++) {
+        if (histogram[k] > 0) {
+            printf("    %12llu - %12llu ns: %llu\n", k > 0 ? 1ULL << k : 0ULL, (1ULL << (k + 1)) - 1, (unsigned long long)histogram[k]);
+        }
+    }
+}
+
+static void print_lock_profile(mem_pool_t* pool) {
+    mem_lock_profile_t profile;
+    mem_pool_lock_profile(pool, &profile);
+    uint64_t acquisitions = profile.acquisitions > 0 ? profile.acquisitions : 1;
+    uint64_t contended = profile.contended > 0 ? profile.contended : 1;
+    printf("Lock profile (%d arenas): %llu acquisitions, %llu contended (%.2f%%)\n", pool->num_arenas,
+           (unsigned long long)profile.acquisitions, (unsigned long long)profile.contended,
+           100.0 * (double)profile.contended / (double)acquisitions);
+    printf("  wait: %llu ns total, %llu ns per contended acquisition\n",
+           (unsigned long long)profile.wait_ns, (unsigned long long)(profile.wait_ns / contended));
+    printf("  hold: %llu ns total, %llu ns per acquisition\n",
+           (unsigned long long)profile.hold_ns, (unsigned long long)(profile.hold_ns / acquisitions));
+    print_histogram("wait (contended only)", profile.wait_histogram);
+    print_histogram("hold", profile.hold_histogram);
+}
+
+void mem_pool_destroy(mem_pool_t* pool) {
+    if (pool == NULL) {
         return;
     }
+    stop_prefault(pool);
+    if (pool->cache_key_created) {
+        destroy_thread_caches(pool);
+    }
+    if (pool->options.profile_locks) {
+        print_lock_profile(pool);
+    }
 
-    block_pool->pnt = memory_pool;
-    block_pool->size = size;
-    block_pool->free = true;
-    block_pool->next = NULL;
+    for (int i = 0; i < pool->num_arenas; i++) {
+        lock_acquire(&pool->arenas[i].lock);
+        bitmap_release_runs(&pool->arenas[i]);
+        if (pool->arenas[i].is_chunk && pool->arenas[i].base != NULL) {
+            release_chunk(&pool->arenas[i]);
+        }
+        release_descriptor_chunks(&pool->arenas[i]);
+        lock_release(&pool->arenas[i].lock);
+        lock_destroy(&pool->arenas[i].lock);
+    }
+    free(pool->arenas);
+    index_destroy(pool);
+
+    if (pool->mapped_size > 0) {
+        os_unmap_pool(pool->memory, pool->mapped_size);
+    } else {
+        free(pool->memory);
+    }
+    pthread_mutex_destroy(&pool->grow_mutex);
+    pthread_mutex_destroy(&pool->cache_list_mutex);
+    free(pool);
+}
+
+void mem_init_ex(size_t size, const mem_options_t* options) {
+    mem_deinit();
 
+    default_pool = mem_pool_create(size, options);
+    if (default_pool == NULL) {
+        printf("Error: Memory pool allocation failed\n");
+        return;
+    }
+    memory_pool = default_pool->memory;
+    block_pool = default_pool->arenas[0].blocks;
     memory_pool_size = size;
-    total_memory_allocated = 0;
+}
 
-    pthread_mutex_unlock(&memory_mutex);
+void mem_init_arenas(size_t size, int count, mem_arena_assign_t assign) {
+    mem_options_t options = {.arenas = count, .arena_assign = assign};
+    mem_init_ex(size, &options);
 }
 
-void* mem_alloc(size_t size) 
-{
+void mem_init(size_t size) {
+    mem_init_ex(size, NULL);
+}
+
+mem_pool_t* mem_default_pool(void) {
+    return default_pool;
+}
+
+// Takes back the blocks other threads have freed for this one since its last allocation.
+static void collect_remote_frees(mem_pool_t* pool) {
+    Thread_Cache* cache = get_thread_cache(pool);
+    if (cache == NULL || __atomic_load_n(&cache->remote_frees, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    remote_collect(cache, false);
+    pthread_mutex_unlock(&cache->lock);
+}
 
-    pthread_mutex_lock(&memory_mutex);
+// Shared by the alloc entry points; size is already a multiple of pool->alignment.
+static void* pool_alloc(mem_pool_t* pool, size_t size, size_t alignment) {
+    if (pool->options.remote_free) {
+        collect_remote_frees(pool);
+    }
 
-    Memory_Block* current = block_pool;
+    size_t granule = bitmap_granule(pool, size, alignment);
+    void* small = granule > 0 ? run_alloc(pool, granule) : NULL;
+    if (small != NULL) {
+        Thread_Cache* owner = get_thread_cache(pool);
+        if (owner != NULL) {
+            stat_add(&owner->stats.allocs, 1);
+        }
+        return small;
+    }
 
-    while (current != NULL)
-    {
-        if (current->free && current->size >= size)
-        {
-            if (current->size == size) {
-                current->free = false;
-                total_memory_allocated += size;
-                pthread_mutex_unlock(&memory_mutex);
-                return current->pnt;
-            }
+    int cls = size_class(size);
+    // Cached blocks are only known to carry the pool's own alignment.
+    Thread_Cache* cache = cls < CACHE_NUM_CLASSES && alignment == pool->alignment ? get_thread_cache(pool) : NULL;
+    Memory_Block* block = NULL;
 
-            Memory_Block* new_block = malloc(sizeof(Memory_Block));
-            if (new_block == NULL) {
-                pthread_mutex_unlock(&memory_mutex);
-                printf("No block allocated\n");
-                return NULL;
+    if (cache != NULL) {
+        pthread_mutex_lock(&cache->lock);
+        block = cache_take(cache, cls, size);
+        if (block == NULL) {
+            block = arena_alloc(pool, size, alignment, cache, cls);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    } else {
+        block = arena_alloc(pool, size, alignment, NULL, cls);
+    }
+
+    // Free memory may be parked in other threads' caches or in empty runs; pull it back before giving up.
+    if (block == NULL) {
+        bool reclaimed = reclaim_thread_caches(pool);
+        if (release_empty_runs(pool) || reclaimed) {
+            block = arena_alloc(pool, size, alignment, NULL, cls);
+        }
+    }
+
+    // A chunk aligned only to the pool's alignment needs room for the padding.
+    size_t grow_size = alignment > pool->alignment ? size + alignment - 1 : size;
+    while (block == NULL) {
+        unsigned int generation = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE);
+        block = arena_alloc(pool, size, alignment, NULL, cls);
+        if (block == NULL && !grow_pool(pool, grow_size, generation)) {
+            break;
+        }
+    }
+
+    Thread_Cache* owner = cache != NULL ? cache : get_thread_cache(pool);
+    if (owner != NULL) {
+        stat_add(block != NULL ? &owner->stats.allocs : &owner->stats.failed_allocs, 1);
+    }
+    if (block != NULL && pool->options.remote_free) {
+        block->owner = owner;
+    }
+    return block != NULL ? block->pnt : NULL;
+}
+
+// Request size as the pool stores it: at least one byte and a multiple of pool->alignment. 0 on overflow.
+static size_t pool_round(mem_pool_t* pool, size_t size) {
+    // Zero-sized requests still get a distinct block so the pointer can be freed.
+    if (size == 0) {
+        size = 1;
+    }
+    if (size > SIZE_MAX - (pool->alignment - 1)) {
+        return 0;
+    }
+    return (size + pool->alignment - 1) & ~(pool->alignment - 1);
+}
+
+void* mem_pool_alloc(mem_pool_t* pool, size_t size) {
+    if (pool == NULL) {
+        return NULL;
+    }
+    size = pool_round(pool, size);
+    return size > 0 ? pool_alloc(pool, size, pool->alignment) : NULL;
+}
+
+void* mem_pool_alloc_aligned(mem_pool_t* pool, size_t size, size_t alignment) {
+    if (pool == NULL || alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= pool->alignment) {
+        return mem_pool_alloc(pool, size);
+    }
+
+    size = pool_round(pool, size);
+    if (size == 0 || size > SIZE_MAX - alignment) {
+        return NULL;
+    }
+    return pool_alloc(pool, size, alignment);
+}
+
+bool mem_pool_alloc_batch(mem_pool_t* pool, const size_t* sizes, void** out, size_t n) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = NULL;
+    }
+    if (pool == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t size = pool_round(pool, sizes[i]);
+        if (size == 0 || total > SIZE_MAX - size) {
+            return false;
+        }
+        total += size;
+    }
+    if (n == 0) {
+        return true;
+    }
+
+    size_t done = 0;
+    Thread_Cache* owner = get_thread_cache(pool);
+    Thread_Cache* remote_owner = pool->options.remote_free ? owner : NULL;
+    Mem_Arena* arena = &pool->arenas[home_arena(pool)];
+    arena_lock(arena);
+
+    // Carve the whole batch from one span; buddy blocks cannot be cut at arbitrary sizes.
+    Memory_Block* block = arena->backend != MEM_BACKEND_BUDDY ? allocate_block(arena, total, pool->alignment) : NULL;
+    if (block != NULL) {
+        while (done < n - 1) {
+            Memory_Block* next = split_block(arena, block, pool_round(pool, sizes[done]));
+            if (next == NULL) {
+                break; // Out of descriptors: the last block keeps the rest of the span.
             }
+            index_insert(next);
+            block->owner = remote_owner;
+            out[done++] = block->pnt;
+            block = next;
+        }
+        block->owner = remote_owner;
+        out[done++] = block->pnt;
+    }
+    for (; done < n; done++) {
+        block = allocate_block(arena, pool_round(pool, sizes[done]), pool->alignment);
+        if (block == NULL) {
+            break;
+        }
+        block->owner = remote_owner;
+        out[done] = block->pnt;
+    }
+    arena_unlock(arena);
 
-            new_block->pnt = (char*)current->pnt + size;
-            new_block->size = current->size - size;
-            new_block->free = true;
-            new_block->next = current->next;
+    if (owner != NULL) {
+        stat_add(&owner->stats.allocs, done);
+    }
 
-            current->size = size;
-            current->free = false;
-            current->next = new_block;
+    // The home arena ran out; mem_pool_alloc can still steal from siblings or grow the pool.
+    for (; done < n; done++) {
+        out[done] = mem_pool_alloc(pool, sizes[done]);
+        if (out[done] == NULL) {
+            mem_pool_free_batch(pool, out, done);
+            memset(out, 0, n * sizeof(void*));
+            return false;
+        }
+    }
+    return true;
+}
 
-            total_memory_allocated += size;
+// Hands a live block to the thread cache, or straight back to its arena when it is too large to cache.
+static void release_block(mem_pool_t* pool, Memory_Block* current) {
+    int cls = size_class(current->size);
+    Thread_Cache* cache = get_thread_cache(pool);
+    if (cache != NULL) {
+        stat_add(&cache->stats.frees, 1);
+    }
 
-            pthread_mutex_unlock(&memory_mutex);
-            return current->pnt;
+    // Blocks of another thread go back to it without a lock; it has exited when the push fails.
+    Thread_Cache* owner = current->owner;
+    if (owner != NULL && owner != cache) {
+        set_cached(current, true);
+        if (remote_push(owner, current)) {
+            return;
         }
+        set_cached(current, false);
+    }
 
-        current = current->next;
+    if (cache != NULL && cls < CACHE_NUM_CLASSES) {
+        pthread_mutex_lock(&cache->lock);
+        cache_put(cache, cls, current);
+        pthread_mutex_unlock(&cache->lock);
+        return;
     }
 
-    pthread_mutex_unlock(&memory_mutex);
-    return NULL;
+    free_blocks(&current, 1);
 }
 
-void mem_free(void* block) {
+// The live block at ptr, or NULL for unknown pointers and double frees (not in the index, or already cached).
+static Memory_Block* live_block(mem_pool_t* pool, void* ptr) {
+    Memory_Block* current = pool != NULL && ptr != NULL ? index_find(pool, ptr) : NULL;
+    return current != NULL && !is_cached(current) ? current : NULL;
+}
+
+void mem_pool_free(mem_pool_t* pool, void* block) {
     if (!block) {
         printf("Nothing to free\n");
         return;
     }
+    if (run_free(pool, block)) {
+        return;
+    }
+
+    Memory_Block* current = live_block(pool, block);
+    if (current != NULL) {
+        release_block(pool, current);
+    }
+}
+
+// A block handed out for size holds at least size rounded for the pool. Outside the buddy backend,
+// where mem_alloc_aligned may round far up, it also holds less than twice that: the thread cache only
+// hands out blocks of the request's size class.
+static bool size_matches(mem_pool_t* pool, Memory_Block* block, size_t size) {
+    size_t rounded = pool_round(pool, size);
+    if (rounded == 0 || block->size < rounded) {
+        return false;
+    }
+    return block->arena->backend == MEM_BACKEND_BUDDY || block->size - rounded < rounded;
+}
 
-    pthread_mutex_lock(&memory_mutex);
+// Goes to stderr, as it flags a bug in the caller rather than a condition it can handle.
+static void report_size_mismatch(size_t size, size_t block_size) {
+    fprintf(stderr, "Error: mem_free_sized called with size %zu for a block of %zu bytes\n", size, block_size);
+}
+
+void mem_pool_free_sized(mem_pool_t* pool, void* block, size_t size) {
+    if (!block) {
+        printf("Nothing to free\n");
+        return;
+    }
+    if (pool == NULL) {
+        return;
+    }
 
-    Memory_Block *current = block_pool;
-    while (current != NULL) 
-    {
-        if (current->pnt == block) {
-            if (!current->free) {
-                total_memory_allocated -= current->size;
+    // Runs only serve requests up to small_block_threshold, so a larger size needs just the lookup of
+    // the block itself. A granule can still turn up there: the first one of a run shares its address
+    // with the run's block, and an aligned request freed with its usable size may exceed the threshold.
+    // Those, and unknown pointers, fall back to the run lookup.
+    size_t rounded = pool_round(pool, size);
+    Memory_Block* current = rounded > pool->options.small_block_threshold ? live_block(pool, block) : NULL;
+    if (current == NULL || __atomic_load_n(&current->run, __ATOMIC_ACQUIRE) != NULL) {
+        Bitmap_Run* run = lock_run(pool, block);
+        if (run != NULL) {
+            // A granule holds any request that rounds up to it.
+            if (pool->options.check_free_size && bitmap_is_live(run, block) && (rounded == 0 || rounded > run->granule)) {
+                arena_unlock(run->arena);
+                report_size_mismatch(size, run->granule);
+                return;
             }
-            current->free = true;
+            release_granule(pool, run, block);
+            return;
+        }
+        current = live_block(pool, block);
+        if (current == NULL) {
+            return;
+        }
+    }
+
+    if (pool->options.check_free_size && !size_matches(pool, current, size)) {
+        report_size_mismatch(size, current->size);
+        return;
+    }
+    release_block(pool, current);
+}
+
+// Blocks freed together in one mem_free_batch pass; larger batches are split into passes of this many.
+#define FREE_BATCH_SIZE 256
+
+static int compare_block_address(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)(*(Memory_Block* const*)a)->pnt;
+    uintptr_t y = (uintptr_t)(*(Memory_Block* const*)b)->pnt;
+    return (x > y) - (x < y);
+}
 
-            // Merge with next free block if possible
-            while (current->next != NULL && current->next->free) {
-                Memory_Block* next_block = current->next;
+void mem_pool_free_batch(mem_pool_t* pool, void** ptrs, size_t n) {
+    Memory_Block* blocks[FREE_BATCH_SIZE];
 
-                current->size += next_block->size;
-                current->next = next_block->next;
+    for (size_t start = 0; start < n; start += FREE_BATCH_SIZE) {
+        int count = 0;
+        for (size_t i = start; i < n && i < start + FREE_BATCH_SIZE; i++) {
+            if (run_free(pool, ptrs[i])) {
+                continue;
+            }
+            Memory_Block* current = live_block(pool, ptrs[i]);
+            if (current != NULL) {
+                blocks[count++] = current;
+            }
+        }
 
-                free(next_block);
+        // In address order each block merges with the one freed just before it, and arenas come in runs.
+        qsort(blocks, count, sizeof(Memory_Block*), compare_block_address);
+        int unique = 0;
+        for (int i = 0; i < count; i++) {
+            if (unique == 0 || blocks[i] != blocks[unique - 1]) {
+                blocks[unique++] = blocks[i];
             }
+        }
+        free_blocks(blocks, unique);
 
-            pthread_mutex_unlock(&memory_mutex);
-            return;
+        Thread_Cache* owner = get_thread_cache(pool);
+        if (owner != NULL) {
+            stat_add(&owner->stats.frees, unique);
+        }
+    }
+}
+// Shrinks or grows a block without moving it, by trading bytes with the free block that follows it.
+// Caller holds the lock of the block's arena.
+static bool resize_block(Memory_Block* block, size_t new_size) {
+    Mem_Arena* arena = block->arena;
+    Memory_Block* next_block = block->next;
+
+    if (new_size < block->size) {
+        size_t tail = block->size - new_size;
+        if (next_block != NULL && next_block->free) {
+            // The freed tail joins the free neighbour, which now starts earlier.
+            char* release_to = next_block->size < arena->release_threshold ? (char*)next_block->pnt + next_block->size : next_block->pnt;
+            free_list_remove(arena, next_block);
+            next_block->pnt = (char*)next_block->pnt - tail;
+            next_block->size += tail;
+            free_list_insert(arena, next_block);
+            os_release_free_pages(arena, next_block, next_block->pnt, release_to);
+        } else {
+            Memory_Block* tail_block = new_descriptor(arena);
+            if (tail_block == NULL) {
+                return false;
+            }
+            tail_block->pnt = (char*)block->pnt + new_size;
+            tail_block->size = tail;
+            tail_block->free = true;
+            tail_block->next = next_block;
+            tail_block->prev = block;
+            if (next_block != NULL) {
+                next_block->prev = tail_block;
+            }
+            block->next = tail_block;
+            arena->splits++;
+            free_list_insert(arena, tail_block);
+            os_release_free_pages(arena, tail_block, tail_block->pnt, (char*)tail_block->pnt + tail);
         }
-        else {
-            current = current->next;
+        block->size = new_size;
+        arena->allocated -= tail;
+        return true;
+    }
+
+    size_t needed = new_size - block->size;
+    if (next_block == NULL || !next_block->free || next_block->size < needed) {
+        return false;
+    }
+
+    free_list_remove(arena, next_block);
+    if (next_block->size > needed) {
+        next_block->pnt = (char*)next_block->pnt + needed;
+        next_block->size -= needed;
+        free_list_insert(arena, next_block);
+    } else {
+        block->next = next_block->next;
+        if (next_block->next != NULL) {
+            next_block->next->prev = block;
         }
+        release_descriptor(arena, next_block);
+        arena->merges++;
+    }
+    block->size = new_size;
+    arena->allocated += needed;
+    return true;
+}
+
+// A granule stays in place for any size it holds; anything larger moves to a new block.
+// Called with the run's arena locked.
+static void* run_resize(mem_pool_t* pool, Bitmap_Run* run, void* ptr, size_t new_size) {
+    Mem_Arena* arena = run->arena;
+    if (!bitmap_is_live(run, ptr)) {
+        arena_unlock(arena);
+        return NULL;
+    }
+    // The granule keeps its slot and size, so only a move is counted.
+    size_t granule = run->granule;
+    if (new_size > granule) {
+        arena->resize_moved++;
     }
+    arena_unlock(arena);
 
-    pthread_mutex_unlock(&memory_mutex);
+    if (new_size <= granule) {
+        return ptr;
+    }
+    void* pnt_new_block = mem_pool_alloc(pool, new_size);
+    if (pnt_new_block == NULL) {
+        return NULL;
+    }
+    memcpy(pnt_new_block, ptr, granule);
+    mem_pool_free(pool, ptr);
+    return pnt_new_block;
 }
 
-void* mem_resize(void* ptr, size_t new_size) {
+void* mem_pool_resize(mem_pool_t* pool, void* ptr, size_t new_size) {
     if (ptr == NULL) {
         printf("Block is NULL");
         return NULL;
     }
+    if (pool == NULL) {
+        return NULL;
+    }
+    new_size = pool_round(pool, new_size);
+    if (new_size == 0) {
+        return NULL;
+    }
+
+    Bitmap_Run* run = lock_run(pool, ptr);
+    if (run != NULL) {
+        return run_resize(pool, run, ptr, new_size);
+    }
+
+    Memory_Block* current = live_block(pool, ptr);
+    if (current == NULL) {
+        return NULL;
+    }
+
+    Mem_Arena* arena = current->arena;
+    arena_lock(arena);
+    size_t old_size = current->size;
+    bool in_place;
+    if (arena->backend == MEM_BACKEND_BUDDY) {
+        in_place = buddy_resize_block(current, new_size);
+    } else {
+        in_place = old_size == new_size || resize_block(current, new_size);
+    }
+    if (in_place && !os_commit(arena, (char*)current->pnt + current->size)) {
+        // The grown part cannot be made writable; undo the growth and try to move instead.
+        if (arena->backend == MEM_BACKEND_BUDDY) {
+            buddy_resize_block(current, old_size);
+        } else {
+            resize_block(current, old_size);
+        }
+        in_place = false;
+    }
+    // A buddy block that stays in its order keeps its size and counts as neither.
+    if (!in_place) {
+        arena->resize_moved++;
+    } else if (current->size < old_size) {
+        arena->resize_shrunk_in_place++;
+    } else if (current->size > old_size) {
+        arena->resize_grown_in_place++;
+    }
+    arena_unlock(arena);
+
+    if (in_place) {
+        return ptr;
+    }
+
+    // No room next to the block: move it. The alloc/free pair runs without any arena lock held.
+    void* pnt_new_block = mem_pool_alloc(pool, new_size);
+    if (pnt_new_block == NULL) {
+        return NULL;
+    }
+    memcpy(pnt_new_block, ptr, old_size < new_size ? old_size : new_size);
+    mem_pool_free(pool, ptr);
+    return pnt_new_block;
+}
+
+void mem_pool_resize_stats(mem_pool_t* pool, mem_resize_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (pool == NULL) {
+        return;
+    }
+    for (int i = 0; i < pool->num_arenas; i++) {
+        lock_acquire(&pool->arenas[i].lock);
+        stats->grown_in_place += pool->arenas[i].resize_grown_in_place;
+        stats->shrunk_in_place += pool->arenas[i].resize_shrunk_in_place;
+        stats->moved += pool->arenas[i].resize_moved;
+        lock_release(&pool->arenas[i].lock);
+    }
+}
+
+void mem_pool_stats(mem_pool_t* pool, mem_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (pool == NULL) {
+        return;
+    }
+
+    // Per-thread counters first, then the arenas; the two halves are not one atomic snapshot.
+    pthread_mutex_lock(&pool->cache_list_mutex);
+    for (Thread_Cache* cache = pool->cache_list; cache != NULL; cache = cache->next) {
+        stats->allocs += __atomic_load_n(&cache->stats.allocs, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&cache->stats.frees, __ATOMIC_RELAXED);
+        stats->failed_allocs += __atomic_load_n(&cache->stats.failed_allocs, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&cache->lock);
+        stats->cached_blocks += __atomic_load_n(&cache->remote_blocks, __ATOMIC_RELAXED);
+        stats->cached_bytes += __atomic_load_n(&cache->remote_bytes, __ATOMIC_RELAXED);
+        for (int cls = 0; cls < CACHE_NUM_CLASSES; cls++) {
+            stats->cached_blocks += cache->counts[cls];
+            for (int i = 0; i < cache->counts[cls]; i++) {
+                stats->cached_bytes += cache->bins[cls][i]->size;
+            }
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    pthread_mutex_unlock(&pool->cache_list_mutex);
 
-    pthread_mutex_lock(&memory_mutex);
-    Memory_Block* current = block_pool;
-    while (current != NULL) {
-        if (current->pnt == ptr) {
-            if (current->size >= new_size) {
-                printf("Block is large enough");
-                pthread_mutex_unlock(&memory_mutex);
-                return ptr;
+    // The arena locks are taken without arena_lock, so reading the stats does not count in them.
+    int count = __atomic_load_n(&pool->num_arenas, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        Mem_Arena* arena = &pool->arenas[i];
+        lock_acquire(&arena->lock);
+        for (Memory_Block* block = arena->blocks; block != NULL; block = block->next) {
+            Bitmap_Run* run = block->run;
+            if (run != NULL) {
+                // Live granules count as allocated blocks, the others as free ones.
+                stats->allocated_blocks += run->used;
+                stats->allocated_bytes += (size_t)run->used * run->granule;
+                stats->free_blocks += run->count - run->used;
+                stats->free_bytes += (size_t)(run->count - run->used) * run->granule;
+                if (run->used < run->count && run->granule > stats->largest_free_block) {
+                    stats->largest_free_block = run->granule;
+                }
+            } else if (block->free) {
+                stats->free_blocks++;
+                stats->free_bytes += block->size;
+                if (block->size > stats->largest_free_block) {
+                    stats->largest_free_block = block->size;
+                }
             } else {
-                void* pnt_new_block = mem_alloc(new_size);
-                if (pnt_new_block == NULL) {
-                    pthread_mutex_unlock(&memory_mutex);
-                    return NULL;
+                stats->allocated_blocks++;
+                stats->allocated_bytes += block->size;
+            }
+        }
+        stats->pool_size += arena->size;
+        stats->splits += arena->splits;
+        stats->merges += arena->merges;
+        stats->lock_waits += arena->lock_waits;
+        stats->lock_wait_ns += arena->lock_wait_ns;
+        lock_release(&arena->lock);
+    }
+
+    // Cached blocks are still allocated as far as their arenas know.
+    stats->allocated_blocks -= stats->cached_blocks < stats->allocated_blocks ? stats->cached_blocks : stats->allocated_blocks;
+    stats->allocated_bytes -= stats->cached_bytes < stats->allocated_bytes ? stats->cached_bytes : stats->allocated_bytes;
+}
+
+static mem_block_state_t block_state(Memory_Block* block) {
+    if (block->free) {
+        return MEM_BLOCK_FREE;
+    }
+    return is_cached(block) ? MEM_BLOCK_CACHED : MEM_BLOCK_USED;
+}
+
+bool mem_pool_walk(mem_pool_t* pool, mem_walk_fn fn, void* arg) {
+    if (pool == NULL) {
+        return true;
+    }
+
+    // One arena is locked at a time, so allocation elsewhere in the pool carries on during the walk.
+    int count = __atomic_load_n(&pool->num_arenas, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        Mem_Arena* arena = &pool->arenas[i];
+        bool more = true;
+        lock_acquire(&arena->lock);
+        for (Memory_Block* block = arena->blocks; block != NULL && more; block = block->next) {
+            Bitmap_Run* run = block->run;
+            if (run == NULL) {
+                more = fn(block->pnt, block->size, block_state(block), arg);
+                continue;
+            }
+            // A run is visited granule by granule.
+            for (int g = 0; g < run->count && more; g++) {
+                mem_block_state_t state = (run->words[g / 64] >> (g % 64)) & 1 ? MEM_BLOCK_USED : MEM_BLOCK_FREE;
+                more = fn(run->base + ((size_t)g << run->shift), run->granule, state, arg);
+            }
+        }
+        lock_release(&arena->lock);
+        if (!more) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void mem_pool_fragmentation_report(mem_pool_t* pool, mem_fragmentation_t* report) {
+    memset(report, 0, sizeof(*report));
+    if (pool == NULL) {
+        return;
+    }
+
+    int count = __atomic_load_n(&pool->num_arenas, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        Mem_Arena* arena = &pool->arenas[i];
+        size_t span = 0;
+        lock_acquire(&arena->lock);
+        for (Memory_Block* block = arena->blocks; block != NULL; block = block->next) {
+            Bitmap_Run* run = block->run;
+            if (run != NULL && run->used < run->count) {
+                // Free granules only serve requests of their own size; each is a span of its own.
+                size_t free_granules = run->count - run->used;
+                report->free_bytes += free_granules * run->granule;
+                report->free_blocks += free_granules;
+                report->histogram[run->shift] += free_granules;
+                if (run->granule > report->largest_free_block) {
+                    report->largest_free_block = run->granule;
                 }
-                memcpy(pnt_new_block, ptr, current->size);
-                mem_free(ptr);
-                pthread_mutex_unlock(&memory_mutex);
-                return pnt_new_block;
+                if (run->granule > report->largest_free_span) {
+                    report->largest_free_span = run->granule;
+                }
+            }
+            if (!block->free) {
+                if (is_cached(block)) {
+                    report->cached_bytes += block->size;
+                }
+                span = 0;
+                continue;
+            }
+
+            report->free_bytes += block->size;
+            report->free_blocks++;
+            report->histogram[size_class(block->size)]++;
+            if (block->size > report->largest_free_block) {
+                report->largest_free_block = block->size;
+            }
+
+            // Buddies of different orders stay separate blocks even when they touch.
+            bool touches = block->prev != NULL && block->prev->free &&
+                           (char*)block->prev->pnt + block->prev->size == (char*)block->pnt;
+            span = touches ? span + block->size : block->size;
+            if (span > report->largest_free_span) {
+                report->largest_free_span = span;
             }
         }
-        current = current->next;
+        lock_release(&arena->lock);
+    }
+
+    if (report->free_bytes > 0) {
+        report->fragmentation = 1.0 - (double)report->largest_free_block / (double)report->free_bytes;
     }
-    pthread_mutex_unlock(&memory_mutex);
-    return NULL;
 }
 
-void mem_deinit() {
-    free(memory_pool);
-    pthread_mutex_lock(&memory_mutex);
-    memory_pool = NULL;
+bool mem_pool_owns(mem_pool_t* pool, void* ptr) {
+    Bitmap_Run* run = lock_run(pool, ptr);
+    if (run != NULL) {
+        bool live = bitmap_is_live(run, ptr);
+        arena_unlock(run->arena);
+        return live;
+    }
+    return live_block(pool, ptr) != NULL;
+}
+
+size_t mem_pool_usable_size(mem_pool_t* pool, void* ptr) {
+    Bitmap_Run* run = lock_run(pool, ptr);
+    if (run != NULL) {
+        size_t size = bitmap_is_live(run, ptr) ? run->granule : 0;
+        arena_unlock(run->arena);
+        return size;
+    }
+    Memory_Block* current = live_block(pool, ptr);
+    return current != NULL ? current->size : 0;
+}
 
-    Memory_Block* current = block_pool;
-    while (current != NULL) {
-        Memory_Block* next_block = current->next;
-        free(current);
-        current = next_block;
+int mem_pool_node_of(mem_pool_t* pool, void* ptr) {
+    Bitmap_Run* run = lock_run(pool, ptr);
+    if (run != NULL) {
+        int node = bitmap_is_live(run, ptr) ? run->arena->node : -1;
+        arena_unlock(run->arena);
+        return node;
     }
+    Memory_Block* current = live_block(pool, ptr);
+    return current != NULL ? current->arena->node : -1;
+}
+
+// The original interface works on the default pool that mem_init sets up.
+
+void* mem_alloc(size_t size)
+{
+    return mem_pool_alloc(default_pool, size);
+}
+
+void* mem_alloc_aligned(size_t size, size_t alignment) {
+    return mem_pool_alloc_aligned(default_pool, size, alignment);
+}
+
+bool mem_alloc_batch(const size_t* sizes, void** out, size_t n) {
+    return mem_pool_alloc_batch(default_pool, sizes, out, n);
+}
+
+void mem_free(void* block) {
+    mem_pool_free(default_pool, block);
+}
+
+void mem_free_sized(void* block, size_t size) {
+    mem_pool_free_sized(default_pool, block, size);
+}
+
+void mem_free_batch(void** ptrs, size_t n) {
+    mem_pool_free_batch(default_pool, ptrs, n);
+}
+
+void* mem_resize(void* ptr, size_t new_size) {
+    return mem_pool_resize(default_pool, ptr, new_size);
+}
+
+void mem_resize_stats(mem_resize_stats_t* stats) {
+    mem_pool_resize_stats(default_pool, stats);
+}
+
+void mem_stats(mem_stats_t* stats) {
+    mem_pool_stats(default_pool, stats);
+}
+
+bool mem_lock_profile(mem_lock_profile_t* profile) {
+    return mem_pool_lock_profile(default_pool, profile);
+}
+
+bool mem_walk(mem_walk_fn fn, void* arg) {
+    return mem_pool_walk(default_pool, fn, arg);
+}
+
+void mem_fragmentation_report(mem_fragmentation_t* report) {
+    mem_pool_fragmentation_report(default_pool, report);
+}
+
+bool mem_owns(void* ptr) {
+    return mem_pool_owns(default_pool, ptr);
+}
+
+size_t mem_usable_size(void* ptr) {
+    return mem_pool_usable_size(default_pool, ptr);
+}
+
+int mem_node_of(void* ptr) {
+    return mem_pool_node_of(default_pool, ptr);
+}
+
+void mem_deinit() {
+    mem_pool_destroy(default_pool);
+    default_pool = NULL;
+    memory_pool = NULL;
     block_pool = NULL;
-    pthread_mutex_unlock(&memory_mutex);
-    pthread_mutex_destroy(&memory_mutex);
-}
\ No newline at end of file
+    memory_pool_size = 0;
+}
@@ -3,6 +3,7 @@
 
 #include <stddef.h>   // För size_t
 #include <stdbool.h>  // För bool
+#include <stdint.h>   // För uint64_t
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,9 +15,92 @@ typedef struct Memory_Block {
     size_t size;                // Storlek på blocket
     bool free;                  // Om blocket är ledigt eller inte
     struct Memory_Block* next;  // Nästa block i kedjan
+    struct Memory_Block* prev;  // Föregående block i kedjan
+    struct Memory_Block* free_prev; // Föregående lediga block i samma storleksklass (vänster barn i placeringsträdet)
+    struct Memory_Block* free_next; // Nästa lediga block i samma storleksklass (höger barn i placeringsträdet)
+    size_t subtree_max;         // Största lediga block i placeringsträdet under detta block
+    struct Memory_Block* index_next; // Nästa block i samma hashkedja i adressindexet
+    bool cached;                // Frigjort men parkerat i en trådcache eller i ägarens kö
+    struct Mem_Arena* arena;    // Arenan som äger blocket
+    struct Bitmap_Run* run;     // Bitmappskörning med små block som ligger i blocket, annars NULL
+    struct Thread_Cache* owner; // Trådcachen för tråden som allokerade blocket när remote_free är på, annars NULL
 } Memory_Block;
 
 
+// Hur trådar fördelas över arenorna i mem_init_arenas
+typedef enum {
+    MEM_ARENA_ROUND_ROBIN,      // Varje ny tråd får nästa arena i tur och ordning
+    MEM_ARENA_PER_CPU,          // Arenan väljs efter den CPU tråden kör på
+    MEM_ARENA_PER_NODE          // Varje NUMA-nod får lika många arenor med minne på noden, och tråden tar dem på noden den kör på.
+                                // Innebär use_mmap; med bara en nod blir det som MEM_ARENA_ROUND_ROBIN
+} mem_arena_assign_t;
+
+
+// Hur varje arena delar upp sitt minne
+typedef enum {
+    MEM_BACKEND_SEGREGATED,     // Storleksklassade fria listor med exakta blockstorlekar (standard)
+    MEM_BACKEND_BUDDY,          // Buddy-system: block i tvåpotenser, O(log n) allokering och sammanslagning
+    MEM_BACKEND_TLSF            // Two-Level Segregated Fit: O(1) allokering och frigöring i värsta fall
+} mem_backend_t;
+
+
+// Var standardmotorn placerar nya block
+typedef enum {
+    MEM_FIT_SIZE_CLASS,         // Första block i minsta storleksklass som räcker (standard)
+    MEM_FIT_NEXT,               // Nästa lediga block som räcker, räknat från förra allokeringen
+    MEM_FIT_BEST,               // Minsta lediga block som räcker, O(log n) via ett storleksordnat träd
+    MEM_FIT_ADDRESS             // Lägsta adress som räcker, O(log n) via ett adressordnat träd
+} mem_fit_t;
+
+
+// Sidstorlek för en mmap-baserad pool
+typedef enum {
+    MEM_PAGES_DEFAULT,          // Vanliga sidor
+    MEM_PAGES_TRANSPARENT_HUGE, // Ber om transparenta stora sidor (madvise MADV_HUGEPAGE)
+    MEM_PAGES_HUGETLB           // Reserverade stora sidor (MAP_HUGETLB), annars som MEM_PAGES_TRANSPARENT_HUGE
+} mem_pages_t;
+
+
+// Hur sidorna i en mmap-baserad pool förs in i minnet i förväg
+typedef enum {
+    MEM_PREFAULT_NONE,          // Sidorna förs in först när de används
+    MEM_PREFAULT_POPULATE,      // Direkt: MAP_POPULATE, eller när varje del görs skrivbar med lazy_commit
+    MEM_PREFAULT_BACKGROUND     // En bakgrundstråd för in poolen bit för bit efter mem_init_ex
+} mem_prefault_t;
+
+
+// Låset som skyddar varje arena
+typedef enum {
+    MEM_LOCK_MUTEX,             // pthread-mutex (standard)
+    MEM_LOCK_ADAPTIVE,          // Snurrar med exponentiell backoff och somnar sedan på en futex
+    MEM_LOCK_MCS                // Kölås: varje väntande tråd snurrar på sin egen nod och får låset i tur och ordning
+} mem_lock_t;
+
+
+// Inställningar för mem_init_ex; nollställda fält ger samma pool som mem_init
+typedef struct {
+    mem_backend_t backend;          // Allokeringsmotor i varje arena
+    int arenas;                     // Antal arenor, 0 betyder en
+    mem_arena_assign_t arena_assign; // Hur trådar fördelas över arenorna
+    mem_fit_t fit;                  // Placeringspolicy; gäller bara MEM_BACKEND_SEGREGATED
+    bool use_mmap;                  // Hämta poolen med mmap i stället för malloc
+    mem_pages_t pages;              // Sidstorlek; kräver use_mmap
+    size_t release_threshold;       // Lediga block på minst så många byte lämnar tillbaka sina sidor till OS; kräver use_mmap, 0 = aldrig
+    bool release_lazy;              // Lämna tillbaka med MADV_FREE (lat) i stället för MADV_DONTNEED
+    bool lazy_commit;               // Reservera adressrymden med PROT_NONE och gör den skrivbar först när allokeringarna når dit; innebär use_mmap
+    mem_prefault_t prefault;        // Förhandsinläsning av sidor; kräver use_mmap eller lazy_commit
+    size_t alignment;               // Standardjustering för alla block (tvåpotens); storlekar avrundas uppåt till en multipel, 0 = ingen
+    bool check_free_size;           // Låt mem_free_sized kontrollera storleken och vägra frigöra vid fel (felsökning)
+    bool growable;                  // Lägg till nya minnesblock när poolen tar slut och lämna tillbaka tomma
+    size_t max_size;                // Tak för poolens totala storlek när den växer, 0 = inget tak
+    mem_lock_t lock;                // Låstyp för arenorna
+    size_t small_block_threshold;   // Allokeringar upp till så många byte (högst 1024) tas ur körningar med en bit metadata per block, 0 = av
+    bool profile_locks;             // Mät vänte- och hålltid för arenalåsen och skriv ut dem vid mem_deinit (felsökning)
+    bool remote_free;               // Block som en annan tråd frigör läggs utan lås i den allokerande trådens kö och tas tillbaka vid dess nästa allokering
+} mem_options_t;
+
+
+// Standardpoolen bakom mem_init, mem_alloc och mem_free
 extern void* memory_pool;
 extern Memory_Block* block_pool;
 extern int memory_pool_size;
@@ -25,17 +109,233 @@ extern int memory_pool_size;
 void mem_init(size_t size);
 
 
+// Som mem_init men med valbar motor och arenor; options får vara NULL. En befintlig standardpool frigörs först
+void mem_init_ex(size_t size, const mem_options_t *options);
+
+
+// Delar poolen i count oberoende arenor med egna lås; tomma arenor lånar från syskonen.
+// Kortform för mem_init_ex med .arenas och .arena_assign
+void mem_init_arenas(size_t size, int count, mem_arena_assign_t assign);
+
+
 void *mem_alloc(size_t size);
 
 
+// Som mem_alloc men blocket börjar på en multipel av alignment (en tvåpotens), annars NULL.
+// Utfyllnaden före blocket blir kvar som ett ledigt block. mem_resize som flyttar blocket ger bara poolens standardjustering.
+// Med buddy-motorn och större justering än arenans start har (en sida för mmap-pooler) får storleken inte överstiga startens justering
+void *mem_alloc_aligned(size_t size, size_t alignment);
+
+
 void mem_free(void *block);
 
 
+// Som mem_free när anroparen vet blockets storlek (den som gavs till mem_alloc/mem_resize, eller mem_usable_size).
+// Med check_free_size ignoreras anrop där storleken inte stämmer
+void mem_free_sized(void *block, size_t size);
+
+
+// Allokerar n block med ett enda lås på hemarenan, om möjligt intill varandra ur ett och samma lediga block.
+// Allt eller inget: vid misslyckande frigörs de som hann allokeras, out fylls med NULL och false returneras
+bool mem_alloc_batch(const size_t *sizes, void **out, size_t n);
+
+
+// Frigör n block i adressordning så att grannar slås ihop direkt; varje arena låses en gång. NULL hoppas över
+void mem_free_batch(void **ptrs, size_t n);
+
+
+// Växer eller krymper blocket på plats när grannen tillåter det, annars flyttas det
 void *mem_resize(void *block, size_t size);
 
 
+// Hur många mem_resize som klarades på plats och hur många som fick flytta blocket
+typedef struct {
+    size_t grown_in_place;      // Växte in i ett ledigt grannblock utan kopiering
+    size_t shrunk_in_place;     // Krympte och lämnade tillbaka svansen
+    size_t moved;               // Fick allokera nytt, kopiera och frigöra (eller misslyckades)
+} mem_resize_stats_t;
+
+
+// Summerar räknarna för alla arenor sedan senaste mem_init
+void mem_resize_stats(mem_resize_stats_t *stats);
+
+
+// Ögonblicksbild av poolen. Räknarna för allokeringar förs per tråd och summeras först här,
+// blockräkningarna tas fram genom att gå igenom arenorna
+typedef struct {
+    size_t pool_size;           // Poolens storlek inklusive tillväxtblock
+    size_t allocated_bytes;     // I levande block
+    size_t allocated_blocks;
+    size_t cached_bytes;        // I frigjorda block som trådcacherna och deras köer håller för återanvändning
+    size_t cached_blocks;
+    size_t free_bytes;
+    size_t free_blocks;
+    size_t largest_free_block;  // Största lediga block, dvs. den största allokering som går utan att poolen växer
+    uint64_t allocs;            // Lyckade allokeringar
+    uint64_t frees;
+    uint64_t failed_allocs;     // Allokeringar som gav NULL
+    uint64_t splits;            // Block som delats
+    uint64_t merges;            // Lediga grannar som slagits ihop
+    uint64_t lock_waits;        // Gånger ett arenalås var upptaget
+    uint64_t lock_wait_ns;      // Total väntetid på arenalås
+} mem_stats_t;
+
+
+void mem_stats(mem_stats_t *stats);
+
+
+// Låsprofil för arenalåsen när poolen skapats med profile_locks. Fack k i histogrammen räknar
+// tider i [2^k, 2^(k+1)) ns; det sista facket tar även allt längre
+#define MEM_LOCK_HISTOGRAM_BUCKETS 32
+
+typedef struct {
+    uint64_t acquisitions;      // Låsningar på allokerings- och frigöringsvägarna
+    uint64_t contended;         // Av dessa: trylock misslyckades och tråden fick vänta
+    uint64_t wait_ns;           // Total väntetid i de omstridda låsningarna
+    uint64_t hold_ns;           // Total tid låsen hållits
+    uint64_t wait_histogram[MEM_LOCK_HISTOGRAM_BUCKETS]; // Väntetid per omstridd låsning
+    uint64_t hold_histogram[MEM_LOCK_HISTOGRAM_BUCKETS]; // Hålltid per låsning
+} mem_lock_profile_t;
+
+
+// false om poolen inte profilerar sina lås
+bool mem_lock_profile(mem_lock_profile_t *profile);
+
+
+// Tillståndet för ett block som mem_walk besöker
+typedef enum {
+    MEM_BLOCK_USED,             // Levande block
+    MEM_BLOCK_CACHED,           // Frigjort men parkerat i en trådcache eller i ägarens kö
+    MEM_BLOCK_FREE
+} mem_block_state_t;
+
+
+// Anropas för varje block; returnera false för att avbryta. Arenans lås hålls under anropet,
+// så funktionen får inte allokera eller frigöra i samma pool
+typedef bool (*mem_walk_fn)(void *ptr, size_t size, mem_block_state_t state, void *arg);
+
+
+// Går igenom blocken arena för arena i adressordning; false om fn avbröt
+bool mem_walk(mem_walk_fn fn, void *arg);
+
+
+// Hur det lediga minnet är uppstyckat. Skiljer en full pool (litet free_bytes) från en
+// fragmenterad (stort free_bytes men litet largest_free_block)
+typedef struct {
+    size_t free_bytes;
+    size_t free_blocks;
+    size_t cached_bytes;        // Ligger i trådcacherna och räknas inte som ledigt
+    size_t largest_free_block;  // Största allokering som går utan att poolen växer
+    size_t largest_free_span;   // Största sammanhängande följd av lediga block; större än blocket när buddies inte kunnat slås ihop
+    double fragmentation;       // Extern fragmentering: 1 - largest_free_block / free_bytes, 0 när allt ledigt är ett block
+    size_t histogram[64];       // Antal lediga block per storleksklass; klass k rymmer [2^k, 2^(k+1)) byte
+} mem_fragmentation_t;
+
+
+// Låser en arena i taget och går igenom blocken en gång, så den kan köras regelbundet under last
+void mem_fragmentation_report(mem_fragmentation_t *report);
+
+
+// Sant om ptr är början på ett levande block från mem_alloc/mem_resize
+bool mem_owns(void *ptr);
+
+
+// Blockets faktiska storlek, eller 0 om ptr inte är ett levande block
+size_t mem_usable_size(void *ptr);
+
+
+// NUMA-noden som blockets minne ligger på med MEM_ARENA_PER_NODE, annars (eller om ptr inte är ett levande block) -1
+int mem_node_of(void *ptr);
+
+
 void mem_deinit();
 
+
+// En fristående pool med egna arenor, lås, index och trådcacher. Funktionerna ovan arbetar på standardpoolen;
+// mem_pool_xxx gör samma sak på en given pool, så att delsystem inte delar lås eller minne med varandra
+typedef struct mem_pool mem_pool_t;
+
+
+// Skapar en pool med samma inställningar som mem_init_ex; NULL om minnet inte räcker
+mem_pool_t *mem_pool_create(size_t size, const mem_options_t *options);
+
+
+// Lämnar tillbaka poolen och allt minne i den; blocken blir ogiltiga
+void mem_pool_destroy(mem_pool_t *pool);
+
+
+// Standardpoolen från mem_init, eller NULL
+mem_pool_t *mem_default_pool(void);
+
+
+void *mem_pool_alloc(mem_pool_t *pool, size_t size);
+
+
+void *mem_pool_alloc_aligned(mem_pool_t *pool, size_t size, size_t alignment);
+
+
+bool mem_pool_alloc_batch(mem_pool_t *pool, const size_t *sizes, void **out, size_t n);
+
+
+void mem_pool_free(mem_pool_t *pool, void *block);
+
+
+void mem_pool_free_sized(mem_pool_t *pool, void *block, size_t size);
+
+
+void mem_pool_free_batch(mem_pool_t *pool, void **ptrs, size_t n);
+
+
+void *mem_pool_resize(mem_pool_t *pool, void *block, size_t size);
+
+
+void mem_pool_resize_stats(mem_pool_t *pool, mem_resize_stats_t *stats);
+
+
+void mem_pool_stats(mem_pool_t *pool, mem_stats_t *stats);
+
+
+bool mem_pool_walk(mem_pool_t *pool, mem_walk_fn fn, void *arg);
+
+
+void mem_pool_fragmentation_report(mem_pool_t *pool, mem_fragmentation_t *report);
+
+
+bool mem_pool_lock_profile(mem_pool_t *pool, mem_lock_profile_t *profile);
+
+
+bool mem_pool_owns(mem_pool_t *pool, void *ptr);
+
+
+size_t mem_pool_usable_size(mem_pool_t *pool, void *ptr);
+
+
+int mem_pool_node_of(mem_pool_t *pool, void *ptr);
+
+
+// Pool av lika stora objekt utskuren ur en minnespool, med en låsfri fri-stack
+typedef struct mem_slab mem_slab_t;
+
+
+// Reserverar count objekt om obj_size byte med ett enda mem_alloc; NULL om poolen inte räcker
+mem_slab_t *mem_slab_create(size_t obj_size, size_t count);
+
+
+// Som mem_slab_create men ur en given pool
+mem_slab_t *mem_pool_slab_create(mem_pool_t *pool, size_t obj_size, size_t count);
+
+
+// Tar ett objekt ur slabben, eller NULL om alla är utdelade
+void *mem_slab_alloc(mem_slab_t *slab);
+
+
+// Lämnar tillbaka ett objekt; okända pekare och dubbla frigöranden ignoreras
+void mem_slab_free(mem_slab_t *slab, void *ptr);
+
+
+// Lämnar tillbaka hela slabben till poolen; måste anropas före mem_deinit/mem_pool_destroy
+void mem_slab_destroy(mem_slab_t *slab);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,178 @@
+// memory_manager_internal.h
+// Shared between the allocator's translation units; not part of the public API.
+#ifndef MEMORY_MANAGER_INTERNAL_H
+#define MEMORY_MANAGER_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "memory_manager.h"
+
+// Free blocks are bucketed by floor(log2(size)); class k holds sizes in [2^k, 2^(k+1)).
+#define NUM_SIZE_CLASSES 64
+
+// The TLSF backend splits each size class into 2^TLSF_SL_BITS linear sub-classes.
+#define TLSF_SL_BITS 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_BITS)
+
+// Block descriptors are carved from chunks of this many, so splits and merges never call malloc/free.
+#define DESCRIPTORS_PER_CHUNK 1024
+
+// Small-block runs (mem_bitmap.c) are BITMAP_RUN_SIZE bytes, aligned to that, and hold granules of
+// 2^BITMAP_MIN_SHIFT to 2^BITMAP_MAX_SHIFT bytes.
+#define BITMAP_RUN_SIZE ((size_t)16 << 10)
+#define BITMAP_MIN_SHIFT 4
+#define BITMAP_MAX_SHIFT 10
+#define BITMAP_CLASSES (BITMAP_MAX_SHIFT - BITMAP_MIN_SHIFT + 1)
+#define BITMAP_RUN_WORDS (BITMAP_RUN_SIZE >> BITMAP_MIN_SHIFT >> 6)
+
+typedef struct Bitmap_Run {
+    struct Mem_Arena* arena;                       // Fixed for the header's lifetime; headers are recycled within their arena
+    Memory_Block* block;                           // The allocated block the run occupies
+    char* base;
+    size_t granule;
+    int shift;                                     // log2(granule)
+    int count;                                     // Granules in the run
+    int used;                                      // Granules handed out
+    uint64_t nonfull;                              // Bit w is set when words[w] has a free granule
+    uint64_t words[BITMAP_RUN_WORDS];              // Bit i is set when granule i is in use
+    struct Bitmap_Run* prev;                       // Neighbours among the arena's runs of this granule that have room,
+    struct Bitmap_Run* next;                       // or the next spare header
+} Bitmap_Run;
+
+typedef struct Descriptor_Chunk {
+    struct Descriptor_Chunk* next;
+    Memory_Block blocks[DESCRIPTORS_PER_CHUNK];
+} Descriptor_Chunk;
+
+// The free blocks of a MEM_FIT_NEXT arena in address order, as parallel arrays so a scan reads
+// packed sizes instead of following block pointers. There is a slot for every descriptor of the
+// arena, so inserting never has to allocate. Removed entries stay behind as holes of size 0.
+typedef struct Free_Table {
+    uintptr_t* addrs;                              // Block start addresses, strictly ascending (holes included)
+    uint64_t* sizes;                               // Block sizes, scanned several at a time with SIMD; 0 for a hole
+    Memory_Block** blocks;
+    size_t count;                                  // Entries in use, holes included
+    size_t holes;
+    size_t capacity;
+    size_t hint;                                   // Where the last lookup ended; the next one is usually close by
+} Free_Table;
+
+// Queue node of an MCS lock waiter, see mem_lock.c
+typedef struct Mcs_Node {
+    struct Mcs_Node* next;
+    uint32_t wait;
+} Mcs_Node;
+
+// Arena lock of the kind chosen in mem_options_t.lock; only the fields of that kind are used.
+typedef struct Mem_Lock {
+    mem_lock_t kind;
+    pthread_mutex_t mutex;                         // MEM_LOCK_MUTEX
+    uint32_t state;                                // MEM_LOCK_ADAPTIVE: 0 free, 1 held, 2 held with sleepers
+    Mcs_Node* tail;                                // MEM_LOCK_MCS: last queued thread, NULL when free
+    Mcs_Node* holder;                              // MEM_LOCK_MCS: node of the thread holding the lock
+} Mem_Lock;
+
+// An arena is an independent slice of a pool's memory (or a growth chunk) with its own lock, block chain and free lists.
+typedef struct Mem_Arena {
+    Mem_Lock lock;
+    struct mem_pool* pool;                         // The pool the arena belongs to
+    mem_backend_t backend;
+    mem_fit_t fit;                                 // Placement policy; only the segregated backend honours it
+    char* base;
+    size_t size;
+    Memory_Block* blocks;                          // First block of the address-ordered chain
+    Memory_Block* free_lists[NUM_SIZE_CLASSES];
+    uint64_t free_class_bitmap;                    // Bit k is set when free_lists[k] (or a TLSF row k) is non-empty
+    Memory_Block* tlsf_lists[NUM_SIZE_CLASSES][TLSF_SL_COUNT];
+    uint32_t tlsf_sl_bitmap[NUM_SIZE_CLASSES];     // Bit j of row k is set when tlsf_lists[k][j] is non-empty
+    Memory_Block* free_tree;                       // Treap of free blocks for MEM_FIT_BEST and MEM_FIT_ADDRESS
+    Memory_Block* rover;                           // Where the next MEM_FIT_NEXT scan starts
+    Free_Table free_table;                         // MEM_FIT_NEXT keeps its free blocks here instead of free_lists
+    Descriptor_Chunk* descriptor_chunks;
+    Memory_Block* spare_descriptors;               // Unused descriptors, linked through free_next
+    Bitmap_Run* runs[BITMAP_CLASSES];              // Runs with a free granule, per granule size
+    Bitmap_Run* spare_runs;                        // Retired run headers, linked through next
+    size_t allocated;                              // Bytes in allocated (including cached) blocks
+    bool is_chunk;                                 // A growth chunk that owns its memory instead of slicing the pool's
+    size_t mapped_size;                            // Length of a chunk's mapping when it came from mmap, else 0
+    int node;                                      // NUMA node the arena's pages are placed on, -1 when not bound
+    char* committed_end;                           // Arena memory below this is writable; the rest is only reserved
+    bool populate_on_commit;                       // Fault committed pages in right away
+    size_t release_threshold;                      // Free blocks at least this large give their pages back (0 = never)
+    bool release_lazy;                             // Release with MADV_FREE instead of MADV_DONTNEED
+    size_t resize_grown_in_place;                  // mem_resize outcomes, see mem_resize_stats
+    size_t resize_shrunk_in_place;
+    size_t resize_moved;
+    uint64_t splits;                               // Blocks cut in two, see mem_stats
+    uint64_t merges;                               // Free neighbours joined
+    uint64_t lock_waits;                           // Acquisitions of lock that found it held
+    uint64_t lock_wait_ns;                         // Time spent waiting in those
+    bool profile_locks;                            // Record every acquisition, see mem_lock_profile
+    uint64_t lock_acquisitions;
+    uint64_t lock_hold_ns;
+    uint64_t locked_at;                            // When the current holder took lock (ns)
+    uint64_t lock_wait_histogram[MEM_LOCK_HISTOGRAM_BUCKETS];
+    uint64_t lock_hold_histogram[MEM_LOCK_HISTOGRAM_BUCKETS];
+} Mem_Arena;
+
+// memory_manager.c
+Memory_Block* new_descriptor(Mem_Arena* arena);
+void release_descriptor(Mem_Arena* arena, Memory_Block* block);
+void index_insert(Memory_Block* block);
+void index_remove(Memory_Block* block);
+int size_class(size_t size);
+void free_list_insert(Mem_Arena* arena, Memory_Block* block);
+void free_list_remove(Mem_Arena* arena, Memory_Block* block);
+
+// mem_buddy.c; callers hold arena->lock
+bool buddy_init_arena(Mem_Arena* arena);
+Memory_Block* buddy_allocate_block(Mem_Arena* arena, size_t size);
+Memory_Block* buddy_allocate_aligned(Mem_Arena* arena, size_t size, size_t alignment);
+void buddy_free_block(Memory_Block* block);
+bool buddy_resize_block(Memory_Block* block, size_t new_size);
+
+// mem_tlsf.c; callers hold arena->lock
+void tlsf_insert(Mem_Arena* arena, Memory_Block* block);
+void tlsf_remove(Mem_Arena* arena, Memory_Block* block);
+Memory_Block* tlsf_find(Mem_Arena* arena, size_t size);
+
+// mem_fit.c; callers hold arena->lock
+void fit_tree_insert(Mem_Arena* arena, Memory_Block* block);
+void fit_tree_remove(Mem_Arena* arena, Memory_Block* block);
+Memory_Block* fit_tree_find(Mem_Arena* arena, size_t size);
+Memory_Block* next_fit_find(Mem_Arena* arena, size_t size);
+bool free_table_grow(Free_Table* table, size_t extra);
+void free_table_insert(Free_Table* table, Memory_Block* block);
+void free_table_remove(Free_Table* table, Memory_Block* block);
+void free_table_release(Free_Table* table);
+size_t free_table_scan(const uint64_t* sizes, size_t count, size_t size);
+
+// mem_bitmap.c; callers hold arena->lock
+int bitmap_class(size_t granule);
+Bitmap_Run* bitmap_run_create(Mem_Arena* arena, Memory_Block* block, size_t granule);
+void bitmap_run_destroy(Mem_Arena* arena, Bitmap_Run* run);
+void bitmap_release_runs(Mem_Arena* arena);
+void* bitmap_take(Mem_Arena* arena, Bitmap_Run* run);
+bool bitmap_release(Mem_Arena* arena, Bitmap_Run* run, void* ptr);
+bool bitmap_is_live(Bitmap_Run* run, void* ptr);
+
+// mem_lock.c
+void lock_init(Mem_Lock* lock, mem_lock_t kind);
+void lock_destroy(Mem_Lock* lock);
+bool lock_try(Mem_Lock* lock);
+void lock_acquire(Mem_Lock* lock);
+void lock_release(Mem_Lock* lock);
+
+// mem_os.c
+void* os_map_pool(size_t size, const mem_options_t* options, size_t* mapped_size);
+bool os_commit(Mem_Arena* arena, char* end);
+bool os_populate(char* start, char* end);
+void os_unmap_pool(void* pool, size_t mapped_size);
+void os_release_free_pages(Mem_Arena* arena, Memory_Block* block, char* from, char* to);
+int os_numa_nodes(int* nodes, int max);
+int os_current_node(void);
+bool os_bind_node(char* start, size_t size, int node);
+
+#endif // MEMORY_MANAGER_INTERNAL_H
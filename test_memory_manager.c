@@ -1,4 +1,6 @@
+#define _GNU_SOURCE // For sched_setaffinity and getcpu
 #include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
 #include <math.h>
 #include <stdbool.h>
@@ -7,6 +9,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 #include <dlfcn.h>
 #include <sys/mman.h>
@@ -42,6 +45,7 @@ typedef struct
     int num_blocks;
     size_t block_size;
     bool simulate_work;
+    mem_options_t options; // Pool options for tests that take them; zero gives the mem_init pool
 } TestParams;
 
 // Function to calculate memory allocations for threads based on redistribution logic
@@ -233,6 +237,131 @@ void *test_zero_alloc_and_free(void *arg)
     return NULL;
 }
 
+void *test_owns_and_usable_size(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+
+    size_t block_size = data->block_size / 2;
+    char *block = (char *)mem_alloc(block_size);
+    my_assert(block != NULL);
+    my_assert(mem_owns(block));
+    my_assert(mem_usable_size(block) >= block_size);
+
+    my_barrier_wait(&barrier);
+
+    mem_free(block);
+    my_assert(!mem_owns(block));
+    my_assert(mem_usable_size(block) == 0);
+
+    return NULL;
+}
+
+/*
+ * Blocks freed by one thread are parked in its cache; another thread must still be able to use that memory.
+ * Every thread frees a few small blocks and waits; thread 0 then allocates the whole pool.
+ */
+void *test_cached_blocks_reclaimed(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    size_t pool_size = data->block_size * data->num_blocks;
+
+    void *blocks[4];
+    for (int i = 0; i < 4; i++)
+    {
+        blocks[i] = mem_alloc(data->block_size / 8);
+        my_assert(blocks[i] != NULL);
+    }
+    for (int i = 0; i < 4; i++)
+        mem_free(blocks[i]);
+
+    my_barrier_wait(&barrier);
+
+    if (data->thread_id == 0)
+    {
+        void *whole_pool = mem_alloc(pool_size);
+        my_assert(whole_pool != NULL);
+        mem_free(whole_pool);
+    }
+
+    my_barrier_wait(&barrier);
+    return NULL;
+}
+
+void test_cache_reclaim_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"reclaiming thread-cached blocks\" (threads: %d, mem_size: %zu) ---> ", params.num_threads, params.memory_size);
+    mem_init(params.memory_size);
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    my_barrier_init(&barrier, params.num_threads);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.memory_size / params.num_threads;
+        params_t[i].num_blocks = params.num_threads;
+        pthread_create(&threads[i], NULL, test_cached_blocks_reclaimed, &params_t[i]);
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+    printf_green("[PASS].\n");
+}
+
+/*
+ * With the pool split into arenas, a thread whose arena is full must borrow from the sibling arenas
+ * before failing. One thread allocates every arena's worth of memory; the next allocation must fail.
+ */
+void test_arena_stealing(TestParams params)
+{
+    printf_yellow("  Testing \"stealing from sibling arenas\" (arenas: %d, mem_size: %zu) ---> ", params.num_threads, params.memory_size);
+    mem_init_arenas(params.memory_size, params.num_threads, MEM_ARENA_ROUND_ROBIN);
+
+    size_t arena_size = params.memory_size / params.num_threads;
+    void *blocks[params.num_threads];
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        blocks[i] = mem_alloc(arena_size);
+        my_assert(blocks[i] != NULL);
+    }
+    my_assert(mem_alloc(1) == NULL);
+
+    for (int i = 0; i < params.num_threads; i++)
+        mem_free(blocks[i]);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_arenas_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"mem_alloc and mem_free across arenas\" (threads: %d, mem_size: %zu) ---> ", params.num_threads, params.memory_size);
+    mem_init_arenas(params.memory_size, params.num_threads, MEM_ARENA_PER_CPU);
+    pthread_t threads[params.num_threads];
+    my_barrier_init(&barrier, params.num_threads);
+    thread_data_t params_t[params.num_threads];
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.memory_size / (2 * params.num_threads); // Leave room for threads sharing a CPU
+        pthread_create(&threads[i], NULL, test_alloc_and_free, &params_t[i]);
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+    printf_green("[PASS].\n");
+}
+
 /*
  * This function is used to test the allocation of random blocks of memory and then freeing them in a multithreading context.
  * The test passes if all allocations and deallocations are successful.
@@ -372,6 +501,58 @@ void test_resize_multithread(TestParams params)
     }
 }
 
+/*
+ * mem_resize grows into a free neighbour and shrinks by returning the tail, both without moving the block.
+ * Only a block with no room behind it is moved, and its contents must survive the move. The sizes are above
+ * the thread cache's refill limit, so the blocks are carved back to back from the arena.
+ */
+void test_resize_in_place(TestParams params)
+{
+    printf_yellow("  Testing \"mem_resize in place\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_init(params.memory_size);
+
+    char *a = mem_alloc(300);
+    char *b = mem_alloc(300);
+    memset(a, 0x5A, 300);
+    memset(b, 0xA5, 300);
+
+    my_assert(mem_resize(b, 900) == b);
+    my_assert(mem_usable_size(b) == 900);
+    sanityCheck(300, b, (char)0xA5);
+
+    char *moved = mem_resize(a, 450);
+    my_assert(moved != NULL && moved != a);
+    sanityCheck(300, moved, 0x5A);
+
+    my_assert(mem_resize(b, 400) == b);
+    my_assert(mem_usable_size(b) == 400);
+    sanityCheck(300, b, (char)0xA5);
+    my_assert(mem_resize(b, 400) == b);
+
+    mem_resize_stats_t stats;
+    mem_resize_stats(&stats);
+    my_assert(stats.grown_in_place == 1 && stats.shrunk_in_place == 1 && stats.moved == 1);
+
+    mem_free(moved);
+    mem_free(b);
+    void *whole_pool = mem_alloc(params.memory_size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+
+    mem_deinit();
+
+    // A buddy block that stays in its order has released nothing.
+    mem_init_ex(params.memory_size, &(mem_options_t){.backend = MEM_BACKEND_BUDDY});
+    char *c = mem_alloc(300);
+    my_assert(mem_resize(c, 260) == c);
+    my_assert(mem_usable_size(c) == 512);
+    mem_resize_stats(&stats);
+    my_assert(stats.grown_in_place == 0 && stats.shrunk_in_place == 0 && stats.moved == 0);
+    mem_free(c);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
 void *alloc_exceeding_memory(void *arg)
 {
     size_t size_to_allocate = (size_t)arg;
@@ -820,7 +1001,7 @@ void run_concurrency_test(TestParams params)
     thread_data_t params_t[params.num_threads];
     my_barrier_init(&barrier, params.num_threads);
     // Initialize your memory manager here
-    mem_init(params.num_blocks * params.block_size); // Initialize with enough memory for the test
+    mem_init_ex(params.num_blocks * params.block_size, &params.options); // Initialize with enough memory for the test
 
     // Create multiple threads to perform memory operations
     for (int i = 0; i < params.num_threads; i++)
@@ -887,104 +1068,1644 @@ void test_looking_for_out_of_bounds(){
   printf("[PASS].\n");
 }
 
-int main(int argc, char *argv[])
+/*
+ * The buddy backend rounds every block up to a power of two and only merges a block with its buddy.
+ * Freeing every other 128-byte block must not yield a 256-byte block; freeing the rest must restore the pool.
+ */
+void test_buddy_backend(TestParams params)
 {
-#ifdef VERSION
-    printf("Build Version; %s \n", VERSION);
-#endif
-    printf("Git Version; %s/%s \n", git_date, git_sha);
+    printf_yellow("  Testing \"buddy backend\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_init_ex(params.memory_size, &(mem_options_t){.backend = MEM_BACKEND_BUDDY});
+
+    // Resizing absorbs free upper buddies or splits off upper halves in place.
+    void *resized = mem_alloc(300);
+    my_assert(mem_resize(resized, params.memory_size) == resized);
+    my_assert(mem_resize(resized, 20) == resized);
+    my_assert(mem_usable_size(resized) == 32);
+    mem_free(resized);
+
+    void *small = mem_alloc(1);
+    void *odd = mem_alloc(100);
+    void *pow2 = mem_alloc(256);
+    my_assert(mem_usable_size(small) == 8);
+    my_assert(mem_usable_size(odd) == 128);
+    my_assert(mem_usable_size(pow2) == 256);
+    mem_free(small);
+    mem_free(odd);
+    mem_free(pow2);
+
+    int count = params.memory_size / 128;
+    void *blocks[count];
+    for (int i = 0; i < count; i++)
+    {
+        blocks[i] = mem_alloc(128);
+        my_assert(blocks[i] != NULL);
+    }
+    my_assert(mem_alloc(1) == NULL);
 
-    if (argc < 2)
+    for (int i = 0; i < count; i += 2)
+        mem_free(blocks[i]);
+    my_assert(mem_alloc(256) == NULL);
+
+    for (int i = 1; i < count; i += 2)
+        mem_free(blocks[i]);
+    void *whole_pool = mem_alloc(params.memory_size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/*
+ * TLSF rounds requests up to its second-level sub-classes but must still hand out a free block that
+ * is an exact fit, and coalesce back to the whole pool.
+ */
+void test_tlsf_backend(TestParams params)
+{
+    printf_yellow("  Testing \"TLSF backend\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_init_ex(params.memory_size, &(mem_options_t){.backend = MEM_BACKEND_TLSF});
+
+    void *whole_pool = mem_alloc(params.memory_size);
+    my_assert(whole_pool != NULL);
+    my_assert(mem_usable_size(whole_pool) == params.memory_size);
+    mem_free(whole_pool);
+
+    int count = 5;
+    void *blocks[count];
+    for (int i = 0; i < count; i++)
     {
-        printf("Usage: %s <test function>\n", argv[0]);
-        printf("Available test functions:\n");
+        blocks[i] = mem_alloc(params.memory_size / count);
+        my_assert(blocks[i] != NULL);
+    }
+    for (int i = 0; i < count; i++)
+        mem_free(blocks[i]);
 
-        printf("  0. tests various functions with a base number of threads\n");
-        printf("  1. tests various functions across variious configurations (number of threads, memory sizes,  iterations)\n");
-        printf("  2. stress tests various functions with various configurations. This may take some time (especially if simulate_work flag is set to true.\n");
-	printf("  3. test_looking_for_out_of_bounds, needs LD_PRELOAD=./libmymalloc.so .\n\n");	
-        return 1;
+    whole_pool = mem_alloc(params.memory_size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/*
+ * The placement policies differ in which hole they pick. Blocks are at least 64 KiB so frees go straight back
+ * to the arena instead of a thread cache. Layout: A (200K) B (10K) C (100K) D (10K) and a free tail; after
+ * freeing A and C, a 90K request goes to A under address-ordered first-fit, to C under best-fit and to
+ * the tail under next-fit, which resumes after D.
+ */
+void test_fit_policies(TestParams params)
+{
+    printf_yellow("  Testing \"placement policies\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_fit_t fits[] = {MEM_FIT_ADDRESS, MEM_FIT_BEST, MEM_FIT_NEXT};
+    size_t k = 1024;
+
+    for (int f = 0; f < 3; f++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.fit = fits[f]});
+
+        char *a = mem_alloc(200 * k);
+        char *b = mem_alloc(10 * k);
+        char *c = mem_alloc(100 * k);
+        char *d = mem_alloc(10 * k);
+        my_assert(a != NULL && b != NULL && c != NULL && d != NULL);
+        mem_free(a);
+        mem_free(c);
+
+        char *placed = mem_alloc(90 * k);
+        if (fits[f] == MEM_FIT_ADDRESS)
+            my_assert(placed == a);
+        else if (fits[f] == MEM_FIT_BEST)
+            my_assert(placed == c);
+        else
+            my_assert(placed == d + 10 * k);
+
+        mem_free(placed);
+        mem_free(b);
+        mem_free(d);
+        void *whole_pool = mem_alloc(params.memory_size);
+        my_assert(whole_pool != NULL);
+        mem_free(whole_pool);
+
+        mem_deinit();
     }
+    printf_green("[PASS].\n");
+}
 
-    // used for case 19
-    int base_num_threads = 4;
-    int allocs;
-    size_t blockSize;
-    bool simulate_work = false; // set this to true to see the benefits of multithreading
+void test_next_fit_table(TestParams params)
+{
+    printf_yellow("  Testing \"next-fit free table\" (blocks: %d) ---> ", params.num_blocks);
+    // Blocks this large bypass the thread cache, so every free reaches the arena's free table at once.
+    size_t size = 70000;
+    mem_init_ex(params.num_blocks * size, &(mem_options_t){.fit = MEM_FIT_NEXT});
+    char *blocks[params.num_blocks];
+    for (int i = 0; i < params.num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(size);
+        my_assert(blocks[i] != NULL && (i == 0 || blocks[i] == blocks[i - 1] + size));
+    }
 
-    switch (atoi(argv[1]))
+    // Holes of one block each: nothing larger fits, and equal requests fill them in address order.
+    for (int i = 0; i < params.num_blocks; i += 2)
+        mem_free(blocks[i]);
+    my_assert(mem_alloc(2 * size) == NULL);
+    for (int i = 0; i < params.num_blocks; i += 2)
+        my_assert(mem_alloc(size) == blocks[i]);
+    my_assert(mem_alloc(1) == NULL);
+
+    // Past the last allocation there is nothing free, so the scan wraps to the lowest hole.
+    mem_free(blocks[10]);
+    mem_free(blocks[4]);
+    my_assert(mem_alloc(size) == blocks[4]);
+    my_assert(mem_alloc(size - 100) == blocks[10]);
+
+    for (int i = 0; i < params.num_blocks; i++)
+        mem_free(blocks[i]);
+    void *whole_pool = mem_alloc(params.num_blocks * size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_options_multithread(TestParams params, mem_options_t options, char *options_name)
+{
+    printf_yellow("  Testing \"mem_alloc and mem_free with %s arenas\" (threads: %d, mem_size: %zu) ---> ", options_name, params.num_threads, params.memory_size);
+    options.arenas = params.num_threads;
+    mem_init_ex(params.memory_size, &options);
+    pthread_t threads[params.num_threads];
+    my_barrier_init(&barrier, params.num_threads);
+    thread_data_t params_t[params.num_threads];
+
+    for (int i = 0; i < params.num_threads; i++)
     {
-    case -1:
-        printf("No tests will be executed.\n");
-        break;
-    case 0:
-        // Running all tests with a base number of threads
-        printf("\n*** Testing various functions with a base number of threads: ***\n");
-        run_concurrent_test(test_alloc_and_free, (TestParams){.num_threads = base_num_threads, .memory_size = 1024}, "mem_alloc and mem_free");
-        run_concurrent_test(test_zero_alloc_and_free, (TestParams){.num_threads = base_num_threads, .memory_size = 1024}, "zero alloc and free");
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.memory_size / (2 * params.num_threads); // Buddy rounds these up to 1/8 + 1/4 of each arena
+        pthread_create(&threads[i], NULL, test_alloc_and_free, &params_t[i]);
+    }
 
-        test_resize_multithread((TestParams){.num_threads = base_num_threads});
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+    printf_green("[PASS].\n");
+}
 
-        test_exceed_single_allocation_multithread((TestParams){.num_threads = base_num_threads});
-        test_exceed_cumulative_allocation_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024}); // TODO: Fix this to be able to run with various configurations
+size_t resident_pages(void *block, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    char *start = (char *)((uintptr_t)block & ~(page - 1));
+    size_t pages = ((char *)block + size - start + page - 1) / page;
+    unsigned char residency[pages];
+    if (mincore(start, pages * page, residency) != 0)
+        return 0;
+
+    size_t count = 0;
+    for (size_t i = 0; i < pages; i++)
+        count += residency[i] & 1;
+    return count;
+}
 
-        test_memory_overcommit_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024});
+/*
+ * An mmap-backed pool hands the pages of large free blocks back to the OS, so a freed block that was
+ * fully touched is no longer resident. Huge pages are only a request and must fall back quietly.
+ */
+void test_mmap_pool(TestParams params)
+{
+    printf_yellow("  Testing \"mmap pool and page release\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_backend_t backends[] = {MEM_BACKEND_SEGREGATED, MEM_BACKEND_BUDDY, MEM_BACKEND_TLSF};
+    size_t block_size = params.memory_size / 2;
 
-        for (int i = 0; i < 4; i++)
-            test_repeated_fit_reuse_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024, .iterations = pow(10, i)});
+    for (int i = 0; i < 3; i++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.backend = backends[i], .use_mmap = true, .release_threshold = 64 * 1024});
 
-        test_memory_fragmentation_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 2048});
-        test_random_blocks_multithread((TestParams){.num_threads = base_num_threads, .block_size = 1024});
+        char *block = mem_alloc(block_size);
+        my_assert(block != NULL);
+        memset(block, 1, block_size);
+        my_assert(resident_pages(block, block_size) == block_size / sysconf(_SC_PAGESIZE));
 
-        break;
+        mem_free(block);
+        my_assert(resident_pages(block, block_size) == 0);
 
-    case 1:
-        printf("\n*** Testing various functions across variious configurations (number of threads, memory sizes,  iterations): ***\n");
-        testAcrossConfigurations(test_resize_multithread, (TestParams){.memory_size = 1024});
-        testAcrossConfigurations(test_exceed_single_allocation_multithread, (TestParams){.memory_size = 1024});
+        mem_deinit();
+    }
 
-        for (int i = 1; i < 6; i++)
-            test_exceed_cumulative_allocation_multithread((TestParams){.num_threads = pow(2, i), .memory_size = pow(2, 11 + i)});
-        break;
-        testAcrossConfigurations(test_memory_overcommit_multithread, (TestParams){.memory_size = 1024});
-        testAcrossConfigurations(test_repeated_fit_reuse_multithread, (TestParams){.iterations = 1});
-        testAcrossConfigurations(test_memory_fragmentation_multithread, (TestParams){.iterations = 1});
-        testAcrossConfigurations(test_random_blocks_multithread, (TestParams){.memory_size = 1024, .block_size = 1024});
+    mem_pages_t pages[] = {MEM_PAGES_TRANSPARENT_HUGE, MEM_PAGES_HUGETLB};
+    for (int i = 0; i < 2; i++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.use_mmap = true, .pages = pages[i]});
+        char *whole_pool = mem_alloc(params.memory_size);
+        my_assert(whole_pool != NULL);
+        memset(whole_pool, 1, params.memory_size);
+        mem_free(whole_pool);
+        mem_deinit();
+    }
+    printf_green("[PASS].\n");
+}
 
-        break;
-    case 2:
-        printf("\n*** Scalability testing: ***\n");
+/*
+ * mem_alloc_aligned returns blocks on every power-of-two alignment up to 8 KiB on each backend, and the
+ * padding in front of them stays usable. A default alignment applies to every block of the pool.
+ */
+void test_aligned_alloc(TestParams params)
+{
+    printf_yellow("  Testing \"aligned allocation\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_backend_t backends[] = {MEM_BACKEND_SEGREGATED, MEM_BACKEND_BUDDY, MEM_BACKEND_TLSF};
 
-        printf("Testing mem_alloc and mem_free\n");
+    for (int i = 0; i < 3; i++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.backend = backends[i], .use_mmap = true});
 
-        for (int i = 1; i < 4; i++)
+        void *blocks[10];
+        for (int j = 0; j < 10; j++)
         {
-            for (int j = 1; j < 5; j++)
-            {
-                run_concurrent_test(test_alloc_and_free, (TestParams){.num_threads = i, .memory_size = pow(2, 9 + j)}, "mem_alloc and mem_free");
-            }
+            size_t alignment = (size_t)16 << j;
+            blocks[j] = mem_alloc_aligned(300 + j, alignment);
+            my_assert(blocks[j] != NULL);
+            my_assert((uintptr_t)blocks[j] % alignment == 0);
+            my_assert(mem_usable_size(blocks[j]) >= 300 + j);
+            memset(blocks[j], j, 300 + j);
         }
+        for (int j = 0; j < 10; j++)
+            mem_free(blocks[j]);
 
-        printf("Testing random blocks\n");
-        for (int i = 2; i < 6; i++)
+        // The padding went back into the pool: it is one free block again.
+        void *whole_pool = mem_alloc(params.memory_size);
+        my_assert(whole_pool != NULL);
+        mem_free(whole_pool);
+
+        my_assert(mem_alloc_aligned(10, 24) == NULL);
+        my_assert(mem_alloc_aligned(10, 0) == NULL);
+        mem_deinit();
+    }
+
+    // A buddy arena on an mmap pool starts on a page, usually not a 16 KiB one. Blocks up to a page are
+    // cut from inside a larger block; blocks that are larger all share the start's offset and fail.
+    mem_init_ex(params.memory_size, &(mem_options_t){.backend = MEM_BACKEND_BUDDY, .use_mmap = true});
+    void *page = mem_alloc_aligned(4096, 16384);
+    my_assert(page != NULL && (uintptr_t)page % 16384 == 0);
+    void *large = mem_alloc_aligned(8192, 16384);
+    my_assert(large == NULL || (uintptr_t)large % 16384 == 0);
+    mem_free(page);
+    if (large != NULL)
+        mem_free(large);
+    void *whole_pool = mem_alloc(params.memory_size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+    mem_deinit();
+
+    // The padding in front of an aligned block is not wasted.
+    mem_init_ex(params.memory_size, &(mem_options_t){.use_mmap = true, .fit = MEM_FIT_ADDRESS});
+    char *first = mem_alloc(300);
+    char *aligned = mem_alloc_aligned(300, 4096);
+    char *filler = mem_alloc(1000);
+    my_assert(first != NULL && aligned != NULL && filler != NULL);
+    my_assert(filler > first && filler < aligned);
+    mem_free(first);
+    mem_free(aligned);
+    mem_free(filler);
+    mem_deinit();
+
+    // A default alignment applies to every block, across arenas and backends.
+    for (int i = 0; i < 3; i++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.backend = backends[i], .arenas = 3, .alignment = 64});
+        size_t sizes[] = {1, 3, 100, 300, 64, 1000};
+        void *blocks[6];
+        for (int j = 0; j < 6; j++)
         {
-            test_random_blocks_multithread((TestParams){.num_threads = pow(2, i), .block_size = 1024});
+            blocks[j] = mem_alloc(sizes[j]);
+            my_assert(blocks[j] != NULL);
+            my_assert((uintptr_t)blocks[j] % 64 == 0);
+            my_assert(mem_usable_size(blocks[j]) % 64 == 0);
         }
+        blocks[2] = mem_resize(blocks[2], 2000);
+        my_assert(blocks[2] != NULL && (uintptr_t)blocks[2] % 64 == 0);
+        for (int j = 0; j < 6; j++)
+            mem_free(blocks[j]);
+        mem_deinit();
+    }
+    printf_green("[PASS].\n");
+}
 
-        allocs = (int)pow(2, 15);
-        blockSize = (int)pow(2, 7);
-        // run_concurrency_test(1, 3, 100);
+void test_batch_alloc(TestParams params)
+{
+    printf_yellow("  Testing \"mem_alloc_batch and mem_free_batch\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_backend_t backends[] = {MEM_BACKEND_SEGREGATED, MEM_BACKEND_BUDDY, MEM_BACKEND_TLSF};
+    size_t sizes[32];
+    void *blocks[32];
+    for (int j = 0; j < 32; j++)
+        sizes[j] = 300 + 37 * j;
+
+    for (int i = 0; i < 3; i++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.backend = backends[i]});
 
-        printf("Testing large number of blocks of fixed size\n");
-        for (int i = 0; i < 9; i++)
-            run_concurrency_test((TestParams){.num_threads = pow(2, i), .num_blocks = allocs, .block_size = blockSize, .simulate_work = simulate_work});
-        break;
+        my_assert(mem_alloc_batch(sizes, blocks, 32));
+        for (int j = 0; j < 32; j++)
+        {
+            my_assert(blocks[j] != NULL);
+            my_assert(mem_usable_size(blocks[j]) >= sizes[j]);
+            memset(blocks[j], j, sizes[j]);
+            // Carved back to back from one free span.
+            if (backends[i] != MEM_BACKEND_BUDDY && j > 0)
+                my_assert((char *)blocks[j] == (char *)blocks[j - 1] + sizes[j - 1]);
+        }
+
+        // Order and duplicates do not matter; NULL is skipped.
+        void *shuffled[34];
+        for (int j = 0; j < 32; j++)
+            shuffled[j] = blocks[(j * 7) % 32];
+        shuffled[32] = NULL;
+        shuffled[33] = blocks[5];
+        mem_free_batch(shuffled, 34);
+        for (int j = 0; j < 32; j++)
+            my_assert(!mem_owns(blocks[j]));
+
+        // A batch with nothing left to free is a no-op.
+        mem_free_batch(shuffled, 34);
+
+        // A batch that does not fit leaves nothing behind.
+        size_t too_large[3] = {100, params.memory_size, 100};
+        void *none[3];
+        my_assert(!mem_alloc_batch(too_large, none, 3));
+        my_assert(none[0] == NULL && none[1] == NULL && none[2] == NULL);
+
+        void *whole_pool = mem_alloc(params.memory_size);
+        my_assert(whole_pool != NULL);
+        mem_free(whole_pool);
+        mem_deinit();
+    }
+    printf_green("[PASS].\n");
+}
+
+void test_sized_free(TestParams params)
+{
+    printf_yellow("  Testing \"mem_free_sized\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_backend_t backends[] = {MEM_BACKEND_SEGREGATED, MEM_BACKEND_BUDDY, MEM_BACKEND_TLSF};
+    size_t sizes[] = {1, 24, 300, 1000, 5000};
+
+    for (int i = 0; i < 3; i++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.backend = backends[i], .check_free_size = true});
+
+        void *blocks[5];
+        for (int j = 0; j < 5; j++)
+        {
+            blocks[j] = mem_alloc(sizes[j]);
+            my_assert(blocks[j] != NULL);
+        }
+
+        // A wrong size is refused and the block stays live.
+        mem_free_sized(blocks[3], mem_usable_size(blocks[3]) + 1);
+        my_assert(mem_owns(blocks[3]));
+        if (backends[i] != MEM_BACKEND_BUDDY)
+        {
+            mem_free_sized(blocks[4], 24);
+            my_assert(mem_owns(blocks[4]));
+        }
+
+        for (int j = 0; j < 5; j++)
+        {
+            mem_free_sized(blocks[j], j % 2 ? sizes[j] : mem_usable_size(blocks[j]));
+            my_assert(!mem_owns(blocks[j]));
+        }
+
+        void *whole_pool = mem_alloc(params.memory_size);
+        my_assert(whole_pool != NULL);
+        mem_free_sized(whole_pool, params.memory_size);
+        mem_deinit();
+    }
+
+    // With runs, sizes above the threshold go straight to the block. Granules still free correctly,
+    // including the first one of a run and an aligned one whose usable size exceeds the threshold.
+    mem_init_ex(params.memory_size, &(mem_options_t){.small_block_threshold = 256, .check_free_size = true});
+    char *granule = mem_alloc(100);
+    char *aligned = mem_alloc_aligned(100, 1024);
+    size_t large_sizes[] = {300, 1000, 5000, 20000};
+    void *large[4];
+    for (int j = 0; j < 4; j++)
+    {
+        large[j] = mem_alloc(large_sizes[j]);
+        my_assert(large[j] != NULL);
+    }
+    my_assert(granule != NULL && aligned != NULL && mem_usable_size(aligned) > 256);
+    mem_free_sized(granule, 5000);
+    my_assert(mem_owns(granule));
+    for (int j = 0; j < 4; j++)
+    {
+        mem_free_sized(large[j], large_sizes[j]);
+        my_assert(!mem_owns(large[j]));
+    }
+    mem_free_sized(aligned, mem_usable_size(aligned));
+    my_assert(!mem_owns(aligned));
+    mem_free_sized(granule, 100);
+    my_assert(!mem_owns(granule));
+    void *whole_pool = mem_alloc(params.memory_size);
+    my_assert(whole_pool != NULL);
+    mem_free_sized(whole_pool, params.memory_size);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_lazy_commit(TestParams params)
+{
+    printf_yellow("  Testing \"lazy commit and prefault\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_backend_t backends[] = {MEM_BACKEND_SEGREGATED, MEM_BACKEND_BUDDY, MEM_BACKEND_TLSF};
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t block_size = 64 * 1024;
+
+    // Only the reservation is made up front, so a pool much larger than the test touches is cheap.
+    for (int i = 0; i < 3; i++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.backend = backends[i], .lazy_commit = true});
+
+        char *blocks[64];
+        for (int j = 0; j < 64; j++)
+        {
+            blocks[j] = mem_alloc(block_size);
+            my_assert(blocks[j] != NULL);
+            memset(blocks[j], j, block_size);
+        }
+        char *grown = mem_resize(blocks[63], 4 * block_size);
+        my_assert(grown != NULL);
+        memset(grown, 1, 4 * block_size);
+        blocks[63] = grown;
+
+        for (int j = 0; j < 64; j++)
+            mem_free(blocks[j]);
+        mem_deinit();
+    }
+
+    // Prefaulted blocks are resident before they are written.
+    mem_init_ex(params.memory_size / 64, &(mem_options_t){.use_mmap = true, .prefault = MEM_PREFAULT_POPULATE});
+    char *block = mem_alloc(block_size);
+    my_assert(block != NULL);
+    my_assert(resident_pages(block, block_size) == block_size / page);
+    mem_free(block);
+    mem_deinit();
+
+    mem_init_ex(params.memory_size, &(mem_options_t){.lazy_commit = true, .prefault = MEM_PREFAULT_POPULATE});
+    block = mem_alloc(block_size);
+    my_assert(block != NULL);
+    my_assert(resident_pages(block, block_size) == block_size / page);
+    mem_free(block);
+    mem_deinit();
+
+    // The background worker must not get in the way of allocations, nor of a deinit while it runs.
+    mem_init_ex(params.memory_size, &(mem_options_t){.lazy_commit = true, .prefault = MEM_PREFAULT_BACKGROUND});
+    block = mem_alloc(block_size);
+    my_assert(block != NULL);
+    memset(block, 1, block_size);
+    mem_free(block);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/*
+ * A growable pool chains extra chunks once the initial pool is full, stops at max_size, and hands a chunk
+ * back when its last block is freed so the space is available to grow again.
+ */
+void test_growable_pool(TestParams params)
+{
+    printf_yellow("  Testing \"growable pool\" (mem_size: %zu) ---> ", params.memory_size);
+    size_t first_chunk = 64 * 1024;
+    size_t second_chunk = 100000;
+    mem_init_ex(params.memory_size, &(mem_options_t){.growable = true, .max_size = params.memory_size + first_chunk + second_chunk});
+
+    void *initial = mem_alloc(params.memory_size);
+    my_assert(initial != NULL);
+
+    char *grown = mem_alloc(4096);
+    my_assert(grown != NULL && mem_owns(grown));
+    memset(grown, 1, 4096);
+
+    char *large = mem_alloc(second_chunk);
+    my_assert(large != NULL && mem_owns(large));
+    memset(large, 2, second_chunk);
+
+    my_assert(mem_alloc(first_chunk) == NULL); // The ceiling is reached
+
+    mem_free(grown); // The first chunk is empty again and goes back
+    void *regrown = mem_alloc(first_chunk);
+    my_assert(regrown != NULL);
+
+    mem_free(regrown);
+    mem_free(large);
+    mem_free(initial);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/*
+ * A growable buddy pool has no power-of-two chunk for a request above 2^63. Such a request fails, and the
+ * pool can still grow afterwards.
+ */
+void test_growable_buddy_huge(TestParams params)
+{
+    printf_yellow("  Testing \"growable buddy pool, huge request\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_init_ex(params.memory_size, &(mem_options_t){.backend = MEM_BACKEND_BUDDY, .growable = true});
+
+    my_assert(mem_alloc(((size_t)1 << 63) | 5) == NULL);
+    my_assert(mem_alloc(SIZE_MAX - 64) == NULL);
+
+    void *grown = mem_alloc(params.memory_size * 4);
+    my_assert(grown != NULL && mem_owns(grown));
+    mem_free(grown);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void *thread_growable_alloc(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char *blocks[data->num_blocks];
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(data->block_size);
+        my_assert(blocks[i] != NULL);
+        if (blocks[i] != NULL)
+            memset(blocks[i], data->thread_id, data->block_size);
+    }
+
+    my_barrier_wait(&barrier);
+
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        sanityCheck(data->block_size, blocks[i], data->thread_id);
+        mem_free(blocks[i]);
+    }
+    return NULL;
+}
+
+void test_growable_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"growing the pool concurrently\" (threads: %d, mem_size: %zu) ---> ", params.num_threads, params.memory_size);
+    mem_init_ex(params.memory_size, &(mem_options_t){.growable = true, .arenas = params.num_threads});
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    my_barrier_init(&barrier, params.num_threads);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].block_size = params.memory_size; // Each thread alone needs many times the initial pool
+        params_t[i].num_blocks = 64;
+        pthread_create(&threads[i], NULL, thread_growable_alloc, &params_t[i]);
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+    printf_green("[PASS].\n");
+}
+
+/*
+ * Pools created with mem_pool_create are independent of each other and of the default pool: ownership,
+ * exhaustion and destruction of one leave the others untouched, and frees into the wrong pool are ignored.
+ */
+void test_pool_instances(TestParams params)
+{
+    printf_yellow("  Testing \"independent pools\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_init(params.memory_size);
+    mem_pool_t *first = mem_pool_create(params.memory_size, NULL);
+    mem_pool_t *second = mem_pool_create(params.memory_size, &(mem_options_t){.backend = MEM_BACKEND_TLSF});
+    my_assert(first != NULL && second != NULL);
+    my_assert(mem_default_pool() != NULL && mem_default_pool() != first);
+
+    char *in_default = mem_alloc(100);
+    char *in_first = mem_pool_alloc(first, 100);
+    char *in_second = mem_pool_alloc(second, 100);
+    my_assert(in_default != NULL && in_first != NULL && in_second != NULL);
+    my_assert(mem_owns(in_default) && !mem_owns(in_first) && !mem_owns(in_second));
+    my_assert(mem_pool_owns(first, in_first) && !mem_pool_owns(first, in_second));
+
+    // Freeing into the wrong pool is ignored.
+    mem_pool_free(second, in_first);
+    my_assert(mem_pool_owns(first, in_first));
+
+    in_first = mem_pool_resize(first, in_first, 300);
+    my_assert(in_first != NULL && mem_pool_usable_size(first, in_first) >= 300);
+
+    // Each pool is exhausted on its own.
+    void *whole_second = NULL;
+    mem_pool_free(second, in_second);
+    whole_second = mem_pool_alloc(second, params.memory_size);
+    my_assert(whole_second != NULL);
+    my_assert(mem_pool_alloc(second, 1) == NULL);
+    my_assert(mem_pool_alloc(first, 100) != NULL);
+
+    // Destroying a pool leaves the others intact, including the default pool.
+    mem_pool_destroy(second);
+    memset(in_first, 1, 300);
+    memset(in_default, 2, 100);
+    mem_pool_free(first, in_first);
+    mem_pool_destroy(first);
+    my_assert(mem_owns(in_default));
+    mem_free(in_default);
+    mem_deinit();
+    my_assert(mem_alloc(1) == NULL);
+    printf_green("[PASS].\n");
+}
+
+void test_mem_stats(TestParams params)
+{
+    printf_yellow("  Testing \"mem_stats\" (mem_size: %zu) ---> ", params.memory_size);
+    mem_stats_t stats;
+    mem_init(params.memory_size);
+
+    mem_stats(&stats);
+    my_assert(stats.pool_size == params.memory_size);
+    my_assert(stats.largest_free_block == params.memory_size);
+    my_assert(stats.allocated_blocks == 0 && stats.allocs == 0 && stats.frees == 0);
+
+    void *small[10];
+    for (int i = 0; i < 10; i++)
+    {
+        small[i] = mem_alloc(100);
+        my_assert(small[i] != NULL);
+    }
+    mem_stats(&stats);
+    my_assert(stats.allocs == 10);
+    my_assert(stats.allocated_blocks == 10 && stats.allocated_bytes >= 1000);
+    my_assert(stats.splits > 0);
+
+    // Small blocks go to the thread cache and still count as cached, not free.
+    for (int i = 0; i < 4; i++)
+        mem_free(small[i]);
+    mem_stats(&stats);
+    my_assert(stats.frees == 4);
+    my_assert(stats.allocated_blocks == 6 && stats.cached_blocks >= 4);
+    my_assert(stats.allocated_bytes + stats.cached_bytes + stats.free_bytes <= stats.pool_size);
+
+    // A block too large for the cache merges back on free.
+    void *large = mem_alloc(params.memory_size / 2);
+    my_assert(large != NULL);
+    mem_stats(&stats);
+    my_assert(stats.largest_free_block < params.memory_size / 2);
+    mem_free(large);
+    mem_stats(&stats);
+    my_assert(stats.merges > 0);
+    my_assert(stats.largest_free_block >= params.memory_size / 2);
+
+    my_assert(mem_alloc(params.memory_size * 2) == NULL);
+    mem_stats(&stats);
+    my_assert(stats.failed_allocs == 1 && stats.allocs == 11 && stats.frees == 5);
+
+    for (int i = 4; i < 10; i++)
+        mem_free(small[i]);
+    mem_deinit();
+
+    // Without a pool everything reads as zero.
+    mem_stats(&stats);
+    my_assert(stats.pool_size == 0 && stats.allocs == 0);
+    printf_green("[PASS].\n");
+}
+
+typedef struct
+{
+    size_t counts[3];
+    size_t bytes;
+    int stop_after;
+} walk_totals_t;
+
+bool count_block(void *ptr, size_t size, mem_block_state_t state, void *arg)
+{
+    walk_totals_t *totals = (walk_totals_t *)arg;
+    my_assert(ptr != NULL && size > 0);
+    totals->counts[state]++;
+    totals->bytes += size;
+    return --totals->stop_after != 0;
+}
+
+void test_heap_walk(TestParams params)
+{
+    printf_yellow("  Testing \"mem_walk and mem_fragmentation_report\" (mem_size: %zu) ---> ", params.memory_size);
+    size_t chunk = params.memory_size / 16;
+    mem_fragmentation_t report;
+    mem_init(params.memory_size);
+
+    void *small[8];
+    for (int i = 0; i < 8; i++)
+        small[i] = mem_alloc(100);
+    for (int i = 0; i < 8; i += 2)
+        mem_free(small[i]);
+    walk_totals_t totals = {.stop_after = -1};
+    my_assert(mem_walk(count_block, &totals));
+    my_assert(totals.counts[MEM_BLOCK_USED] == 4 && totals.counts[MEM_BLOCK_CACHED] >= 4);
+    my_assert(totals.bytes == params.memory_size);
+
+    totals = (walk_totals_t){.stop_after = 2};
+    my_assert(!mem_walk(count_block, &totals));
+    my_assert(totals.counts[MEM_BLOCK_USED] + totals.counts[MEM_BLOCK_CACHED] + totals.counts[MEM_BLOCK_FREE] == 2);
+    mem_deinit();
+
+    // Every other chunk free: half the pool is free, but no allocation above one chunk fits.
+    mem_init(params.memory_size);
+    void *chunks[16];
+    for (int i = 0; i < 16; i++)
+    {
+        chunks[i] = mem_alloc(chunk);
+        my_assert(chunks[i] != NULL);
+    }
+    mem_fragmentation_report(&report);
+    my_assert(report.free_bytes == 0 && report.fragmentation == 0.0);
+    for (int i = 0; i < 16; i += 2)
+        mem_free(chunks[i]);
+    mem_fragmentation_report(&report);
+    my_assert(report.free_bytes == params.memory_size / 2 && report.free_blocks == 8);
+    my_assert(report.largest_free_block == chunk && report.largest_free_span == chunk);
+    my_assert(report.histogram[__builtin_ctzll(chunk)] == 8);
+    my_assert(report.fragmentation > 0.87 && report.fragmentation < 0.88);
+    for (int i = 1; i < 16; i += 2)
+        mem_free(chunks[i]);
+    mem_fragmentation_report(&report);
+    my_assert(report.largest_free_block == params.memory_size && report.fragmentation == 0.0);
+    mem_deinit();
+
+    // Buddies of different orders that touch form one span but not one block.
+    mem_init_ex(params.memory_size, &(mem_options_t){.backend = MEM_BACKEND_BUDDY});
+    void *a = mem_alloc(params.memory_size / 8);
+    void *b = mem_alloc(params.memory_size / 8);
+    void *c = mem_alloc(params.memory_size / 4);
+    void *d = mem_alloc(params.memory_size / 2);
+    my_assert(a != NULL && b != NULL && c != NULL && d != NULL);
+    mem_free(b);
+    mem_free(c);
+    mem_fragmentation_report(&report);
+    my_assert(report.largest_free_block == params.memory_size / 4);
+    my_assert(report.largest_free_span == params.memory_size / 8 * 3);
+    mem_free(a);
+    mem_free(d);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void *lock_profile_worker(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    my_barrier_wait(&barrier);
+    for (int it = 0; it < data->iterations; it++)
+    {
+        // Too large for the thread cache, so every call takes an arena lock.
+        char *block = mem_alloc(data->block_size);
+        if (block != NULL)
+        {
+            memset(block, data->thread_id, data->block_size);
+            mem_free(block);
+        }
+    }
+    return NULL;
+}
+
+void test_lock_profile(TestParams params)
+{
+    printf_yellow("  Testing \"lock profile\" (threads: %d) ---> ", params.num_threads);
+    mem_lock_profile_t profile;
+    size_t block_size = 128 * 1024;
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+
+    mem_init(block_size * params.num_threads);
+    my_assert(!mem_lock_profile(&profile));
+    mem_deinit();
+
+    mem_init_ex(block_size * params.num_threads, &(mem_options_t){.profile_locks = true});
+    my_barrier_init(&barrier, params.num_threads);
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i] = (thread_data_t){.thread_id = i, .block_size = block_size, .iterations = params.iterations};
+        pthread_create(&threads[i], NULL, lock_profile_worker, &params_t[i]);
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    my_barrier_destroy(&barrier);
+
+    my_assert(mem_lock_profile(&profile));
+    my_assert(profile.acquisitions >= (uint64_t)params.num_threads * params.iterations * 2);
+    my_assert(profile.contended <= profile.acquisitions);
+    uint64_t waits = 0, holds = 0;
+    for (int k = 0; k < MEM_LOCK_HISTOGRAM_BUCKETS; k++)
+    {
+        waits += profile.wait_histogram[k];
+        holds += profile.hold_histogram[k];
+    }
+    my_assert(waits == profile.contended && holds == profile.acquisitions);
+    my_assert(profile.hold_ns > 0);
+
+    // Reading the statistics does not add to them.
+    mem_stats_t stats;
+    mem_fragmentation_t report;
+    walk_totals_t totals = {.stop_after = -1};
+    mem_stats(&stats);
+    mem_fragmentation_report(&report);
+    my_assert(mem_walk(count_block, &totals));
+    mem_lock_profile_t after;
+    my_assert(mem_lock_profile(&after));
+    mem_stats_t stats_after;
+    mem_stats(&stats_after);
+    my_assert(after.acquisitions == profile.acquisitions && after.hold_ns == profile.hold_ns);
+    my_assert(stats_after.lock_waits == stats.lock_waits);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void *small_block_worker(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char *blocks[data->num_blocks];
+    my_barrier_wait(&barrier);
+
+    for (int it = 0; it < data->iterations; it++)
+    {
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            blocks[i] = mem_alloc(1 + (i * 37 + it) % data->block_size);
+            my_assert(blocks[i] != NULL);
+            if (blocks[i] != NULL)
+                memset(blocks[i], data->thread_id, 1 + (i * 37 + it) % data->block_size);
+        }
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            sanityCheck(1 + (i * 37 + it) % data->block_size, blocks[i], data->thread_id);
+            mem_free(blocks[i]);
+        }
+    }
+    return NULL;
+}
+
+void test_small_blocks(TestParams params)
+{
+    printf_yellow("  Testing \"small blocks from bitmap runs\" (threads: %d, mem_size: %zu) ---> ", params.num_threads, params.memory_size);
+    mem_init_ex(params.memory_size, &(mem_options_t){.small_block_threshold = 256});
+
+    // A fresh run hands out consecutive granules, each aligned to its size.
+    char *blocks[100];
+    for (int i = 0; i < 100; i++)
+    {
+        blocks[i] = mem_alloc(24);
+        my_assert(blocks[i] != NULL && ((uintptr_t)blocks[i] & 31) == 0);
+        my_assert(mem_owns(blocks[i]) && mem_usable_size(blocks[i]) == 32);
+        memset(blocks[i], i, 24);
+    }
+    for (int i = 1; i < 100; i++)
+        my_assert(blocks[i] == blocks[i - 1] + 32);
+    mem_stats_t stats;
+    mem_stats(&stats);
+    my_assert(stats.allocated_blocks == 100);
+
+    // Freed granules are found again lowest first; double frees are ignored.
+    for (int i = 0; i < 100; i += 2)
+        mem_free(blocks[i]);
+    mem_free(blocks[0]);
+    my_assert(!mem_owns(blocks[0]) && mem_usable_size(blocks[0]) == 0);
+    my_assert(mem_owns(blocks[1]));
+    my_assert(mem_alloc(20) == blocks[0]);
+    mem_stats(&stats);
+    my_assert(stats.allocated_blocks == 51);
+
+    // Resizing stays in place within the granule and moves beyond it.
+    my_assert(mem_resize(blocks[1], 30) == blocks[1]);
+    char *moved = mem_resize(blocks[1], 500);
+    my_assert(moved != NULL && moved != blocks[1] && !mem_owns(blocks[1]));
+    for (int k = 0; k < 24; k++)
+        my_assert(moved[k] == 1);
+    mem_free(moved);
+    my_assert(mem_usable_size(mem_alloc(1000)) == 1000);
+
+    // With everything freed the empty runs go back, and the whole pool can be allocated again.
+    mem_deinit();
+    mem_init_ex(params.memory_size, &(mem_options_t){.small_block_threshold = 1 << 20});
+    for (int i = 0; i < 100; i++)
+        blocks[i] = mem_alloc(1 + i * 10);
+    for (int i = 0; i < 100; i++)
+        mem_free(blocks[i]);
+    void *whole_pool = mem_alloc(params.memory_size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+    mem_deinit();
+
+    mem_init_ex(params.memory_size, &(mem_options_t){.small_block_threshold = 256, .arenas = 2});
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    my_barrier_init(&barrier, params.num_threads);
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i] = (thread_data_t){.thread_id = i, .block_size = 300, .num_blocks = 64, .iterations = params.iterations};
+        pthread_create(&threads[i], NULL, small_block_worker, &params_t[i]);
+    }
+    for (int i = 0; i < params.num_threads; i++)
+        pthread_join(threads[i], NULL);
+    my_barrier_destroy(&barrier);
+    mem_stats(&stats);
+    my_assert(stats.allocated_blocks == 0);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void *remote_free_producer(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_blocks; i++)
+    {
+        data->block_pointers[i] = mem_alloc(data->block_size);
+        my_assert(data->block_pointers[i] != NULL);
+    }
+    data->block_pointers[data->num_blocks] = mem_alloc(128 * 1024);
+    my_assert(data->block_pointers[data->num_blocks] != NULL);
+    my_barrier_wait(&barrier); // The main thread frees the blocks
+    my_barrier_wait(&barrier);
+
+    // The next allocation takes the freed blocks back and reuses one of them.
+    void *reused = mem_alloc(data->block_size);
+    bool found = false;
+    for (int i = 0; i < data->num_blocks; i++)
+        found |= reused == data->block_pointers[i];
+    my_assert(found);
+    data->block_pointers[0] = reused;
+    return NULL;
+}
+
+// Like remote_free_producer, but the blocks come from one mem_alloc_batch call.
+void *remote_batch_producer(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    size_t sizes[data->num_blocks];
+    for (int i = 0; i < data->num_blocks; i++)
+        sizes[i] = data->block_size;
+    my_assert(mem_alloc_batch(sizes, data->block_pointers, data->num_blocks));
+    my_barrier_wait(&barrier); // The main thread frees the blocks
+    my_barrier_wait(&barrier);
+
+    void *reused = mem_alloc(data->block_size);
+    bool found = false;
+    for (int i = 0; i < data->num_blocks; i++)
+        found |= reused == data->block_pointers[i];
+    my_assert(found);
+    mem_free(reused);
+    return NULL;
+}
+
+static void **remote_slots; // num_blocks pointers per thread, freed by the next thread
+static int remote_threads;
+
+void *remote_free_worker(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    char **mine = (char **)remote_slots + data->thread_id * data->num_blocks;
+    char **theirs = (char **)remote_slots + (data->thread_id + 1) % remote_threads * data->num_blocks;
+    int neighbour = (data->thread_id + 1) % remote_threads;
+
+    for (int it = 0; it < data->iterations; it++)
+    {
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            size_t size = 1 + (i * 37 + it) % data->block_size;
+            mine[i] = mem_alloc(size);
+            my_assert(mine[i] != NULL);
+            if (mine[i] != NULL)
+                memset(mine[i], data->thread_id, size);
+        }
+        my_barrier_wait(&barrier);
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            sanityCheck(1 + (i * 37 + it) % data->block_size, theirs[i], neighbour);
+            mem_free(theirs[i]);
+        }
+        my_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+void test_remote_free(TestParams params)
+{
+    printf_yellow("  Testing \"remote frees\" (threads: %d, mem_size: %zu) ---> ", params.num_threads, params.memory_size);
+    mem_init_ex(params.memory_size, &(mem_options_t){.remote_free = true});
+
+    // Blocks freed by another thread wait on their owner's queue and count as cached.
+    void *blocks[17];
+    thread_data_t producer = {.block_size = 128, .num_blocks = 16, .block_pointers = blocks};
+    pthread_t thread;
+    my_barrier_init(&barrier, 2);
+    pthread_create(&thread, NULL, remote_free_producer, &producer);
+    my_barrier_wait(&barrier);
+    for (int i = 0; i < 17; i++)
+        mem_free(blocks[i]);
+    mem_free(blocks[0]);
+    my_assert(!mem_owns(blocks[0]));
+    mem_stats_t stats;
+    mem_stats(&stats);
+    my_assert(stats.frees == 17 && stats.cached_blocks == 17 && stats.allocated_blocks == 0);
+    my_assert(stats.largest_free_block < params.memory_size - 128 * 1024);
+
+    // The owner's allocation returns the large block to the arena and keeps the small ones.
+    my_barrier_wait(&barrier);
+    pthread_join(thread, NULL);
+    my_barrier_destroy(&barrier);
+    mem_stats(&stats);
+    my_assert(stats.allocated_blocks == 1 && stats.cached_blocks == 0);
+    my_assert(stats.largest_free_block >= 128 * 1024);
+
+    // Its owner has exited, so the last block takes the ordinary path.
+    mem_free(blocks[0]);
+    mem_stats(&stats);
+    my_assert(stats.allocated_blocks == 0 && stats.allocs == 18 && stats.frees == 18);
+    mem_deinit();
+
+    // Blocks from mem_alloc_batch go back to their owner the same way.
+    mem_init_ex(params.memory_size, &(mem_options_t){.remote_free = true});
+    producer = (thread_data_t){.block_size = 128, .num_blocks = 16, .block_pointers = blocks};
+    my_barrier_init(&barrier, 2);
+    pthread_create(&thread, NULL, remote_batch_producer, &producer);
+    my_barrier_wait(&barrier);
+    for (int i = 0; i < 16; i++)
+        mem_free(blocks[i]);
+    my_barrier_wait(&barrier);
+    pthread_join(thread, NULL);
+    my_barrier_destroy(&barrier);
+    mem_stats(&stats);
+    my_assert(stats.allocated_blocks == 0 && stats.allocs == 17 && stats.frees == 17);
+    mem_deinit();
+
+    // Every thread frees what its neighbour allocated; in the end the whole pool is free again.
+    for (int arenas = 1; arenas <= 2; arenas++)
+    {
+        mem_init_ex(params.memory_size, &(mem_options_t){.remote_free = true, .arenas = arenas});
+        pthread_t threads[params.num_threads];
+        thread_data_t params_t[params.num_threads];
+        remote_slots = calloc(params.num_threads * params.num_blocks, sizeof(void *));
+        remote_threads = params.num_threads;
+        my_barrier_init(&barrier, params.num_threads);
+        for (int i = 0; i < params.num_threads; i++)
+        {
+            params_t[i] = (thread_data_t){.thread_id = i, .block_size = 2000, .num_blocks = params.num_blocks, .iterations = params.iterations};
+            pthread_create(&threads[i], NULL, remote_free_worker, &params_t[i]);
+        }
+        for (int i = 0; i < params.num_threads; i++)
+            pthread_join(threads[i], NULL);
+        my_barrier_destroy(&barrier);
+        free(remote_slots);
+
+        mem_stats(&stats);
+        my_assert(stats.allocated_blocks == 0 && stats.cached_blocks == 0);
+        void *whole_pool = mem_alloc(params.memory_size / arenas);
+        my_assert(whole_pool != NULL);
+        mem_free(whole_pool);
+        mem_deinit();
+    }
+    printf_green("[PASS].\n");
+}
+
+// Online NUMA nodes as the kernel lists them ("0-1,3"); a machine without the sysfs entry has node 0.
+int read_numa_nodes(int *nodes, int max)
+{
+    FILE *file = fopen("/sys/devices/system/node/online", "r");
+    int count = 0, first, last;
+    char separator = ',';
+    while (file != NULL && separator == ',' && fscanf(file, "%d", &first) == 1)
+    {
+        last = first;
+        if (fscanf(file, "%c", &separator) == 1 && separator == '-' && fscanf(file, "%d%c", &last, &separator) < 1)
+            break;
+        for (int node = first; node <= last && count < max; node++)
+            nodes[count++] = node;
+    }
+    if (file != NULL)
+        fclose(file);
+    if (count == 0)
+        nodes[count++] = 0;
+    return count;
+}
+
+// First CPU of a node, or -1 when it has none (or sysfs does not say).
+int first_cpu_of_node(int node)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *file = fopen(path, "r");
+    int cpu = -1;
+    if (file != NULL && fscanf(file, "%d", &cpu) != 1)
+        cpu = -1;
+    if (file != NULL)
+        fclose(file);
+    return cpu;
+}
+
+void pin_to_cpu(int cpu)
+{
+    if (cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+void test_numa_arenas(TestParams params)
+{
+    printf_yellow("  Testing \"NUMA arenas\" (mem_size: %zu) ---> ", params.memory_size);
+    cpu_set_t saved;
+    sched_getaffinity(0, sizeof(saved), &saved);
+    pin_to_cpu(sched_getcpu());
+    unsigned int cpu, node;
+    getcpu(&cpu, &node);
+
+    // Blocks come from the node the thread runs on; on a single node (or without mbind) nothing is bound.
+    int nodes[64];
+    bool single_node = read_numa_nodes(nodes, 64) == 1;
+    mem_init_ex(params.memory_size, &(mem_options_t){.arena_assign = MEM_ARENA_PER_NODE, .arenas = 2});
+    void *blocks[10];
+    for (int i = 0; i < 10; i++)
+    {
+        blocks[i] = mem_alloc(1000 * (i + 1));
+        my_assert(blocks[i] != NULL);
+        my_assert(mem_node_of(blocks[i]) == (single_node ? -1 : mem_node_of(blocks[0])));
+        my_assert(mem_node_of(blocks[i]) == -1 || mem_node_of(blocks[i]) == (int)node);
+    }
+    for (int i = 0; i < 10; i++)
+        mem_free(blocks[i]);
+    my_assert(mem_node_of(blocks[0]) == -1);
+    my_assert(mem_node_of(NULL) == -1);
+
+    // The whole pool is still usable; other arenas are stolen from once the local ones are full.
+    void *whole = mem_alloc(params.memory_size / 2);
+    my_assert(whole != NULL);
+    mem_free(whole);
+    mem_deinit();
+
+    sched_setaffinity(0, sizeof(saved), &saved);
+    printf_green("[PASS].\n");
+}
+
+void *thread_private_pool(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    mem_pool_t *pool = mem_pool_create(data->block_size * data->num_blocks, NULL);
+    my_assert(pool != NULL);
+    char *blocks[data->num_blocks];
+
+    for (int it = 0; it < data->iterations; it++)
+    {
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            blocks[i] = mem_pool_alloc(pool, data->block_size);
+            my_assert(blocks[i] != NULL);
+            if (blocks[i] != NULL)
+                memset(blocks[i], data->thread_id, data->block_size);
+        }
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            sanityCheck(data->block_size, blocks[i], data->thread_id);
+            mem_pool_free(pool, blocks[i]);
+        }
+    }
+    mem_pool_destroy(pool);
+    return NULL;
+}
+
+void test_pool_per_thread(TestParams params)
+{
+    printf_yellow("  Testing \"a private pool per thread\" (threads: %d) ---> ", params.num_threads);
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i] = (thread_data_t){.thread_id = i, .block_size = 64, .num_blocks = 32, .iterations = params.iterations};
+        pthread_create(&threads[i], NULL, thread_private_pool, &params_t[i]);
+    }
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    printf_green("[PASS].\n");
+}
+
+/*
+ * A slab hands out exactly count objects, reuses freed ones and ignores pointers it does not own.
+ */
+void test_slab_basic(TestParams params)
+{
+    printf_yellow("  Testing \"slab alloc and free\" (objects: %d, mem_size: %zu) ---> ", params.num_blocks, params.memory_size);
+    mem_init(params.memory_size);
+
+    size_t obj_size = params.memory_size / params.num_blocks;
+    mem_slab_t *slab = mem_slab_create(obj_size, params.num_blocks);
+    my_assert(slab != NULL);
+    my_assert(mem_slab_create(obj_size, 1) == NULL); // The first slab took the whole pool
+
+    char *objects[params.num_blocks];
+    for (int i = 0; i < params.num_blocks; i++)
+    {
+        objects[i] = mem_slab_alloc(slab);
+        my_assert(objects[i] != NULL);
+        memset(objects[i], i, obj_size);
+    }
+    my_assert(mem_slab_alloc(slab) == NULL);
+
+    for (int i = 0; i < params.num_blocks; i++)
+        my_assert(objects[i][0] == (char)i && objects[i][obj_size - 1] == (char)i);
+
+    mem_slab_free(slab, objects[1] + 1); // Not the start of an object
+    mem_slab_free(slab, &obj_size);      // Not in the slab at all
+    my_assert(mem_slab_alloc(slab) == NULL);
+
+    mem_slab_free(slab, objects[1]);
+    mem_slab_free(slab, objects[1]); // Double free is ignored
+    my_assert(mem_slab_alloc(slab) == objects[1]);
+    my_assert(mem_slab_alloc(slab) == NULL);
+
+    for (int i = 0; i < params.num_blocks; i++)
+        mem_slab_free(slab, objects[i]);
+    mem_slab_destroy(slab);
+
+    void *whole_pool = mem_alloc(params.memory_size);
+    my_assert(whole_pool != NULL);
+    mem_free(whole_pool);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+mem_slab_t *shared_slab;
+
+void *thread_slab_alloc_free(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    int *objects[data->num_blocks];
+
+    for (int iter = 0; iter < data->iterations; iter++)
+    {
+        int count = 0;
+        for (int i = 0; i < data->num_blocks; i++)
+        {
+            objects[count] = mem_slab_alloc(shared_slab);
+            if (objects[count] != NULL)
+                *objects[count++] = data->thread_id * data->num_blocks + i;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            my_assert(*objects[i] / data->num_blocks == data->thread_id);
+            mem_slab_free(shared_slab, objects[i]);
+        }
+    }
+
+    my_barrier_wait(&barrier);
+    return NULL;
+}
+
+void test_slab_multithread(TestParams params)
+{
+    printf_yellow("  Testing \"slab alloc and free\" (threads: %d, objects: %d) ---> ", params.num_threads, params.num_blocks);
+    mem_init(sizeof(int) * params.num_blocks);
+    shared_slab = mem_slab_create(sizeof(int), params.num_blocks);
+    my_assert(shared_slab != NULL);
+
+    pthread_t threads[params.num_threads];
+    thread_data_t params_t[params.num_threads];
+    my_barrier_init(&barrier, params.num_threads);
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        params_t[i].thread_id = i;
+        params_t[i].num_blocks = params.num_blocks / params.num_threads + 1; // Slightly oversubscribed
+        params_t[i].iterations = params.iterations;
+        pthread_create(&threads[i], NULL, thread_slab_alloc_free, &params_t[i]);
+    }
+
+    for (int i = 0; i < params.num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Every object must be back on the free stack exactly once.
+    int count = 0;
+    while (mem_slab_alloc(shared_slab) != NULL)
+        count++;
+    my_assert(count == params.num_blocks);
+
+    mem_slab_destroy(shared_slab);
+    mem_deinit();
+    my_barrier_destroy(&barrier);
+    printf_green("[PASS].\n");
+}
+
+/*
+ * Allocation latency percentiles for one backend or placement policy. The pool is first filled with num_blocks
+ * random-sized blocks and then churned by freeing or allocating random slots, so the timings reflect a heap with
+ * history. A configuration with bounded allocation cost keeps p99.9 flat as num_blocks grows.
+ */
+int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+void benchmark_alloc_latency(mem_options_t options, char *options_name, int num_blocks)
+{
+    size_t max_block_size = 2048;
+    int ops = 200000;
+    mem_init_ex(num_blocks * max_block_size, &options);
+
+    void **blocks = calloc(num_blocks, sizeof(void *));
+    long *latencies = malloc(ops * sizeof(long));
+    int measured = 0, failed = 0;
+    srand(1);
+
+    for (int i = 0; i < num_blocks; i++)
+        blocks[i] = mem_alloc(1 + rand() % max_block_size);
+
+    for (int op = 0; op < ops; op++)
+    {
+        int i = rand() % num_blocks;
+        if (blocks[i] != NULL)
+        {
+            mem_free(blocks[i]);
+            blocks[i] = NULL;
+            continue;
+        }
+
+        size_t size = 1 + rand() % max_block_size;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        blocks[i] = mem_alloc(size);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        latencies[measured++] = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+        if (blocks[i] == NULL)
+            failed++;
+    }
+
+    qsort(latencies, measured, sizeof(long), compare_long);
+    printf_yellow("  %-15s blocks: %7d  p50: %6ld ns  p99: %6ld ns  p99.9: %7ld ns  max: %8ld ns  failed: %d\n", options_name, num_blocks,
+                  latencies[measured / 2], latencies[(int)(measured * 0.99)], latencies[(int)(measured * 0.999)], latencies[measured - 1], failed);
+
+    for (int i = 0; i < num_blocks; i++)
+        if (blocks[i] != NULL)
+            mem_free(blocks[i]);
+    free(blocks);
+    free(latencies);
+    mem_deinit();
+}
+
+/*
+ * Memory throughput with MEM_ARENA_PER_NODE. A thread on each node allocates and first-touches a buffer, which the
+ * pool places on that node; then a thread on every node streams through every buffer. Reading a buffer on the
+ * reader's own node is local access, any other is remote. A single-node machine only has the local case.
+ */
+typedef struct
+{
+    int cpu;
+    size_t size;
+    char *buffer;
+    double seconds;
+} numa_job_t;
+
+void *numa_allocate(void *arg)
+{
+    numa_job_t *job = (numa_job_t *)arg;
+    pin_to_cpu(job->cpu);
+    job->buffer = mem_alloc(job->size);
+    if (job->buffer != NULL)
+        memset(job->buffer, 1, job->size);
+    return NULL;
+}
+
+void *numa_read(void *arg)
+{
+    numa_job_t *job = (numa_job_t *)arg;
+    pin_to_cpu(job->cpu);
+    uint64_t sum = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int pass = 0; pass < 8; pass++)
+        for (size_t i = 0; i < job->size / sizeof(uint64_t); i++)
+            sum += ((volatile uint64_t *)job->buffer)[i];
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    my_assert(sum == (uint64_t)8 * (job->size / sizeof(uint64_t)) * 0x0101010101010101ULL);
+    return NULL;
+}
+
+void benchmark_numa_access(size_t buffer_size)
+{
+    int nodes[64];
+    int num_nodes = read_numa_nodes(nodes, 64);
+    mem_init_ex(num_nodes * buffer_size + 1024 * 1024, &(mem_options_t){.arena_assign = MEM_ARENA_PER_NODE});
+
+    numa_job_t jobs[64];
+    pthread_t thread;
+    for (int i = 0; i < num_nodes; i++)
+    {
+        jobs[i] = (numa_job_t){.cpu = first_cpu_of_node(nodes[i]), .size = buffer_size};
+        pthread_create(&thread, NULL, numa_allocate, &jobs[i]);
+        pthread_join(thread, NULL);
+        if (jobs[i].buffer == NULL)
+        {
+            printf("Error: could not allocate the buffer for node %d\n", nodes[i]);
+            mem_deinit();
+            return;
+        }
+        printf("Buffer %d: allocated on node %d, placed on node %d\n", i, nodes[i], mem_node_of(jobs[i].buffer));
+    }
+    if (num_nodes == 1)
+        printf("Only one NUMA node: the pool is not bound and there is no remote access to measure.\n");
+
+    for (int reader = 0; reader < num_nodes; reader++)
+    {
+        for (int i = 0; i < num_nodes; i++)
+        {
+            numa_job_t job = {.cpu = first_cpu_of_node(nodes[reader]), .size = buffer_size, .buffer = jobs[i].buffer};
+            pthread_create(&thread, NULL, numa_read, &job);
+            pthread_join(thread, NULL);
+            printf("Reader on node %d, buffer of node %d (%s): %.2f GB/s\n", nodes[reader], nodes[i], reader == i ? "local" : "remote",
+                   8.0 * buffer_size / job.seconds / 1e9);
+        }
+    }
+
+    for (int i = 0; i < num_nodes; i++)
+        mem_free(jobs[i].buffer);
+    mem_deinit();
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef VERSION
+    printf("Build Version; %s \n", VERSION);
+#endif
+    printf("Git Version; %s/%s \n", git_date, git_sha);
+
+    if (argc < 2)
+    {
+        printf("Usage: %s <test function>\n", argv[0]);
+        printf("Available test functions:\n");
+
+        printf("  0. tests various functions with a base number of threads\n");
+        printf("  1. tests various functions across variious configurations (number of threads, memory sizes,  iterations)\n");
+        printf("  2. stress tests various functions with various configurations. This may take some time (especially if simulate_work flag is set to true.\n");
+	printf("  3. test_looking_for_out_of_bounds, needs LD_PRELOAD=./libmymalloc.so .\n");
+        printf("  4. benchmarks mem_alloc latency percentiles for each backend and placement policy as the number of blocks grows.\n");
+        printf("  5. benchmarks the concurrency test with each arena lock (pthread mutex, adaptive, MCS) as the number of threads grows.\n");
+        printf("  6. benchmarks local vs remote memory throughput with per-NUMA-node arenas.\n\n");
+        return 1;
+    }
+
+    // used for case 19
+    int base_num_threads = 4;
+    int allocs;
+    size_t blockSize;
+    bool simulate_work = false; // set this to true to see the benefits of multithreading
+
+    switch (atoi(argv[1]))
+    {
+    case -1:
+        printf("No tests will be executed.\n");
+        break;
+    case 0:
+        // Running all tests with a base number of threads
+        printf("\n*** Testing various functions with a base number of threads: ***\n");
+        run_concurrent_test(test_alloc_and_free, (TestParams){.num_threads = base_num_threads, .memory_size = 1024}, "mem_alloc and mem_free");
+        run_concurrent_test(test_zero_alloc_and_free, (TestParams){.num_threads = base_num_threads, .memory_size = 1024}, "zero alloc and free");
+        run_concurrent_test(test_owns_and_usable_size, (TestParams){.num_threads = base_num_threads, .memory_size = 1024}, "mem_owns and mem_usable_size");
+        test_cache_reclaim_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024});
+        test_arena_stealing((TestParams){.num_threads = base_num_threads, .memory_size = 1024});
+        test_arenas_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096});
+        test_buddy_backend((TestParams){.memory_size = 1024});
+        test_options_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096}, (mem_options_t){.backend = MEM_BACKEND_BUDDY}, "buddy");
+        test_tlsf_backend((TestParams){.memory_size = 1000});
+        test_options_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096}, (mem_options_t){.backend = MEM_BACKEND_TLSF}, "TLSF");
+        test_fit_policies((TestParams){.memory_size = 1024 * 1024});
+        test_next_fit_table((TestParams){.num_blocks = 64});
+        test_options_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096}, (mem_options_t){.fit = MEM_FIT_NEXT}, "next-fit");
+        test_options_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096}, (mem_options_t){.fit = MEM_FIT_BEST}, "best-fit");
+        test_options_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096}, (mem_options_t){.fit = MEM_FIT_ADDRESS}, "address-ordered");
+        test_options_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096}, (mem_options_t){.lock = MEM_LOCK_ADAPTIVE}, "adaptive lock");
+        test_options_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096}, (mem_options_t){.lock = MEM_LOCK_MCS, .arenas = 2}, "MCS lock");
+        test_options_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 4096}, (mem_options_t){.arena_assign = MEM_ARENA_PER_NODE, .arenas = 2}, "per-node");
+        test_mmap_pool((TestParams){.memory_size = 8 * 1024 * 1024});
+        test_aligned_alloc((TestParams){.memory_size = 64 * 1024});
+        test_batch_alloc((TestParams){.memory_size = 64 * 1024});
+        test_sized_free((TestParams){.memory_size = 64 * 1024});
+        test_lazy_commit((TestParams){.memory_size = (size_t)1024 * 1024 * 1024});
+        test_growable_pool((TestParams){.memory_size = 1024});
+        test_growable_buddy_huge((TestParams){.memory_size = 1024});
+        test_growable_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024});
+        test_pool_instances((TestParams){.memory_size = 4096});
+        test_pool_per_thread((TestParams){.num_threads = base_num_threads, .iterations = 100});
+        test_mem_stats((TestParams){.memory_size = 256 * 1024});
+        test_heap_walk((TestParams){.memory_size = 1024 * 1024});
+        test_lock_profile((TestParams){.num_threads = base_num_threads, .iterations = 1000});
+        test_small_blocks((TestParams){.num_threads = base_num_threads, .memory_size = 1024 * 1024, .iterations = 100});
+        test_remote_free((TestParams){.num_threads = base_num_threads, .memory_size = 1024 * 1024, .num_blocks = 32, .iterations = 100});
+        test_numa_arenas((TestParams){.memory_size = 1024 * 1024});
+        test_slab_basic((TestParams){.num_blocks = 16, .memory_size = 1024});
+        test_slab_multithread((TestParams){.num_threads = base_num_threads, .num_blocks = 64, .iterations = 1000});
+
+        test_resize_multithread((TestParams){.num_threads = base_num_threads});
+        test_resize_in_place((TestParams){.memory_size = 2048});
+
+        test_exceed_single_allocation_multithread((TestParams){.num_threads = base_num_threads});
+        test_exceed_cumulative_allocation_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024}); // TODO: Fix this to be able to run with various configurations
+
+        test_memory_overcommit_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024});
+
+        for (int i = 0; i < 4; i++)
+            test_repeated_fit_reuse_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 1024, .iterations = pow(10, i)});
+
+        test_memory_fragmentation_multithread((TestParams){.num_threads = base_num_threads, .memory_size = 2048});
+        test_random_blocks_multithread((TestParams){.num_threads = base_num_threads, .block_size = 1024});
+
+        break;
+
+    case 1:
+        printf("\n*** Testing various functions across variious configurations (number of threads, memory sizes,  iterations): ***\n");
+        testAcrossConfigurations(test_resize_multithread, (TestParams){.memory_size = 1024});
+        testAcrossConfigurations(test_exceed_single_allocation_multithread, (TestParams){.memory_size = 1024});
+
+        for (int i = 1; i < 6; i++)
+            test_exceed_cumulative_allocation_multithread((TestParams){.num_threads = pow(2, i), .memory_size = pow(2, 11 + i)});
+        break;
+        testAcrossConfigurations(test_memory_overcommit_multithread, (TestParams){.memory_size = 1024});
+        testAcrossConfigurations(test_repeated_fit_reuse_multithread, (TestParams){.iterations = 1});
+        testAcrossConfigurations(test_memory_fragmentation_multithread, (TestParams){.iterations = 1});
+        testAcrossConfigurations(test_random_blocks_multithread, (TestParams){.memory_size = 1024, .block_size = 1024});
+
+        break;
+    case 2:
+        printf("\n*** Scalability testing: ***\n");
+
+        printf("Testing mem_alloc and mem_free\n");
+
+        for (int i = 1; i < 4; i++)
+        {
+            for (int j = 1; j < 5; j++)
+            {
+                run_concurrent_test(test_alloc_and_free, (TestParams){.num_threads = i, .memory_size = pow(2, 9 + j)}, "mem_alloc and mem_free");
+            }
+        }
+
+        printf("Testing random blocks\n");
+        for (int i = 2; i < 6; i++)
+        {
+            test_random_blocks_multithread((TestParams){.num_threads = pow(2, i), .block_size = 1024});
+        }
+
+        allocs = (int)pow(2, 15);
+        blockSize = (int)pow(2, 7);
+        // run_concurrency_test(1, 3, 100);
+
+        printf("Testing large number of blocks of fixed size\n");
+        for (int i = 0; i < 9; i++)
+            run_concurrency_test((TestParams){.num_threads = pow(2, i), .num_blocks = allocs, .block_size = blockSize, .simulate_work = simulate_work});
+        break;
 
     case 3:
       printf("Test 3.\n");
       test_looking_for_out_of_bounds();
       break;
 
+    case 4:
+        printf("\n*** Allocation latency benchmark: ***\n");
+        for (int i = 3; i < 6; i++)
+        {
+            benchmark_alloc_latency((mem_options_t){.backend = MEM_BACKEND_SEGREGATED}, "segregated", pow(10, i));
+            benchmark_alloc_latency((mem_options_t){.backend = MEM_BACKEND_BUDDY}, "buddy", pow(10, i));
+            benchmark_alloc_latency((mem_options_t){.backend = MEM_BACKEND_TLSF}, "TLSF", pow(10, i));
+            benchmark_alloc_latency((mem_options_t){.fit = MEM_FIT_NEXT}, "next-fit", pow(10, i));
+            benchmark_alloc_latency((mem_options_t){.fit = MEM_FIT_BEST}, "best-fit", pow(10, i));
+            benchmark_alloc_latency((mem_options_t){.fit = MEM_FIT_ADDRESS}, "address-ordered", pow(10, i));
+            benchmark_alloc_latency((mem_options_t){.small_block_threshold = 1024}, "bitmap runs", pow(10, i));
+        }
+        break;
+
+    case 5:
+        printf("\n*** Arena lock benchmark: ***\n");
+        allocs = (int)pow(2, 15);
+        blockSize = (int)pow(2, 7);
+        mem_lock_t locks[] = {MEM_LOCK_MUTEX, MEM_LOCK_ADAPTIVE, MEM_LOCK_MCS};
+        char *lock_names[] = {"pthread mutex", "adaptive", "MCS"};
+        for (int k = 0; k < 3; k++)
+        {
+            printf("Lock: %s\n", lock_names[k]);
+            for (int i = 0; i < 7; i++)
+                run_concurrency_test((TestParams){.num_threads = pow(2, i), .num_blocks = allocs, .block_size = blockSize, .options = {.lock = locks[k]}});
+        }
+        break;
+
+    case 6:
+        printf("\n*** NUMA access benchmark: ***\n");
+        benchmark_numa_access((size_t)64 * 1024 * 1024);
+        break;
+
     default:
         printf("Invalid test function\n");
         break;